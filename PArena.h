@@ -0,0 +1,253 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PArena - Frame Arena(for PBox)
+//
+// Scratch memory that's thrown away all at once...
+// * PArena - bump allocator. alloc() just moves a pointer along a block,
+//   reset() moves it back to the start. Nothing is freed one by one.
+// * PArenaArray - growable array(push_back/clear/sort) living in an arena.
+//   Plain data only, nothing gets constructed or destructed.
+//
+// PWorld keeps two arenas and swaps them every step, so last step's data
+// (warm starting) stays valid while this step's is built. SpocTree keeps
+// one for its bucket indices.
+//
+// When a step needs more than one block, the next reset() swaps them all
+// for a single block big enough for the whole step. After a step or two of
+// the same scene, stepping doesn't touch the heap at all.
+//
+// pheapallocs counts every block allocated. Define PBOX_COUNTALLOCS(in one
+// .cpp, before including PBox.h) and it counts every operator new in the
+// program too. pworld.stats.heapallocs has the count for the last step.
+//
+// Usage:
+// PArena arena;
+// PArenaArray <int> list( &arena );
+// list.push_back( 5 );
+// arena.reset();
+// list.setarena( &arena );
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PARENA_H
+#define PARENA_H
+
+// malloc()/free().
+#include <stdlib.h>
+// size_t.
+#include <stddef.h>
+// Counting allocations from any thread.
+#include <atomic>
+
+#ifdef PBOX_COUNTALLOCS
+// std::bad_alloc.
+#include <new>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Heap allocations made by arenas, and by everything else when
+// PBOX_COUNTALLOCS is defined. Only ever goes up. Arenas on worker threads
+// count too, so it's atomic.
+std::atomic <unsigned long long> pheapallocs( 0 );
+
+#ifdef PBOX_COUNTALLOCS
+void *operator new( size_t _bytes ) {
+	pheapallocs++;
+	void *mem = malloc( _bytes ? _bytes : 1 );
+	if( !mem ) throw std::bad_alloc();
+	return mem;
+}
+void *operator new[]( size_t _bytes ) { return operator new( _bytes ); }
+void operator delete( void *_mem ) noexcept { free( _mem ); }
+void operator delete[]( void *_mem ) noexcept { free( _mem ); }
+void operator delete( void *_mem, size_t ) noexcept { free( _mem ); }
+void operator delete[]( void *_mem, size_t ) noexcept { free( _mem ); }
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Bump allocator. Blocks are chained, newest first.
+class PArena {
+	public:
+		// Everything handed out is aligned to this.
+		static const size_t ALIGN = 16;
+
+		// _blocksize is the smallest block we ask the heap for.
+		PArena( size_t _blocksize = 64 * 1024 ): blocks(0), top(0), blocksize(_blocksize), used(0) {}
+		~PArena() { release(); }
+
+		///////////////////////////////////////////////////////////////////////
+		// _bytes of scratch, valid until reset().
+		void *alloc( size_t _bytes ) {
+			_bytes = ( _bytes + ALIGN - 1 ) & ~( ALIGN - 1 );
+			if( !blocks || top + _bytes > blocks->size )
+				newblock( _bytes );
+			void *mem = (char *)blocks + HEADER + top;
+			top += _bytes;
+			used += _bytes;
+			return mem;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Room for _count T's. Not constructed.
+		template <class T>
+		T *alloc( int _count ) {
+			return (T *)alloc( sizeof(T) * _count );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Throws everything away. More than one block means the last round
+		// didn't fit, so they're swapped for one twice the size it needed.
+		// Room to grow, or a slowly growing scene would get a new block every
+		// few steps.
+		void reset( void ) {
+			if( blocks && blocks->next ) {
+				size_t need = used * 2;
+				release();
+				blocksize = ( need > blocksize ) ? need : blocksize;
+				newblock( 0 );
+			}
+			top = 0;
+			used = 0;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Bytes handed out since the last reset().
+		size_t bytesused( void ) const { return used; }
+
+	private:
+		// Block header, the memory follows it.
+		struct Block {
+			Block *next;
+			size_t size;
+		};
+		// Header size, rounded up so the memory after it stays aligned.
+		static const size_t HEADER = ( sizeof(Block) + ALIGN - 1 ) & ~( ALIGN - 1 );
+
+		// Newest block, the one we're bumping through.
+		Block *blocks;
+		// Bytes used in the newest block.
+		size_t top;
+		// Smallest block size.
+		size_t blocksize;
+		// Bytes used in all blocks.
+		size_t used;
+
+		// Starts a block big enough for _bytes.
+		void newblock( size_t _bytes ) {
+			size_t size = ( _bytes > blocksize ) ? _bytes : blocksize;
+			Block *block = (Block *)malloc( HEADER + size );
+			pheapallocs++;
+			block->next = blocks;
+			block->size = size;
+			blocks = block;
+			top = 0;
+		}
+
+		// Gives every block back to the heap.
+		void release( void ) {
+			while( blocks ) {
+				Block *next = blocks->next;
+				free( blocks );
+				blocks = next;
+			}
+			top = 0;
+		}
+
+		// Copying would free the blocks twice.
+		PArena( const PArena & );
+		PArena &operator=( const PArena & );
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Growable array in an arena. Growing copies into a bigger piece of the
+// arena and leaves the old one there until reset().
+// Once the arena is reset, call setarena() before using it again.
+template <class T>
+class PArenaArray {
+	public:
+		PArenaArray( PArena *_arena = 0 ): arena(_arena), items(0), num(0), cap(0) {}
+
+		// Empties the array and takes memory from _arena from now on.
+		void setarena( PArena *_arena ) {
+			arena = _arena;
+			items = 0;
+			num = cap = 0;
+		}
+
+		// Keeps the items, but copies them into _arena and grows there from
+		// now on. For handing an array to another thread's arena.
+		void moveto( PArena *_arena ) {
+			T *old = items;
+			int oldnum = num;
+			setarena( _arena );
+			append( old, oldnum );
+		}
+
+		PArena *getarena( void ) const { return arena; }
+
+		int size( void ) const { return num; }
+		bool empty( void ) const { return num == 0; }
+		void clear( void ) { num = 0; }
+
+		T &operator[]( int _idx ) { return items[_idx]; }
+		const T &operator[]( int _idx ) const { return items[_idx]; }
+		T &back( void ) { return items[num - 1]; }
+		// Pointers work as iterators, so std::sort() and friends are fine.
+		T *begin( void ) { return items; }
+		T *end( void ) { return items + num; }
+		const T *begin( void ) const { return items; }
+		const T *end( void ) const { return items + num; }
+
+		void push_back( const T &_val ) {
+			if( num == cap )
+				reserve( cap ? cap * 2 : 16 );
+			items[ num++ ] = _val;
+		}
+
+		// Adds _count items from _vals to the end.
+		void append( const T *_vals, int _count ) {
+			reserve( num + _count );
+			for( int v = 0; v < _count; v++ )
+				items[ num++ ] = _vals[v];
+		}
+
+		// Grows(filling with _val) or shrinks to _num items.
+		void resize( int _num, const T &_val = T() ) {
+			reserve( _num );
+			for( int v = num; v < _num; v++ )
+				items[v] = _val;
+			num = _num;
+		}
+
+		// _num copies of _val.
+		void assign( int _num, const T &_val ) {
+			num = 0;
+			resize( _num, _val );
+		}
+
+		// Makes room for at least _cap items.
+		void reserve( int _cap ) {
+			if( _cap <= cap )
+				return;
+			_cap = ( _cap < cap * 2 ) ? cap * 2 : _cap;
+			T *grown = arena->alloc<T>( _cap );
+			for( int v = 0; v < num; v++ )
+				grown[v] = items[v];
+			items = grown;
+			cap = _cap;
+		}
+
+		// Trades contents(and arenas) with _other.
+		void swap( PArenaArray &_other ) {
+			PArenaArray tmp = *this;
+			*this = _other;
+			_other = tmp;
+		}
+
+	private:
+		PArena *arena;
+		T *items;
+		int num;
+		int cap;
+};
+
+#endif // PARENA_H
@@ -0,0 +1,202 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PBodies - Box Container With Handles(for PBox)
+//
+// Boxes that come and go while the world runs. Every box lives in one
+// packed array, the one PBox::update() steps, so removing a box moves the
+// last one into its place(PBox::removebox()). That means indices change, so
+// add() hands back a PHandle instead...
+// * A slot, which keeps track of where its box is in the array.
+// * A generation, bumped every time the slot's box is removed. Handles to
+//   a removed box stop working, even once the slot holds a new box.
+//
+// Adding is a push_back(), the next update() puts the box in the octree.
+// Removing is a swap and a pop, its sphere and static slot go with it.
+// Neither rebuilds the tree, and contacts/warm starting carry on for every
+// box that stays. Add and remove between update()s, not during one.
+//
+// Add order is rarely space order, so neighbours end up all over the
+// array. sort() puts boxes in Morton order(see PBox::sortboxes()) and
+// moves the slots with them, handles don't notice. Set sortevery and
+// update() does it every that many steps.
+//
+// Every PBodies steps one world, pworld unless it's given another.
+//
+// Usage:
+// PBodies bodies;
+// PHandle h = bodies.add( PBox(vec3(0, 5, 0)) );
+// bodies.update();
+// if( PBox *box = bodies.get(h) )
+// 		box->setvel( vec3(0, 0.1f, 0) );
+// bodies.remove( h );
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PBODIES_H
+#define PBODIES_H
+
+// Lists of things.
+#include <vector>
+
+// Boxes and update().
+#include "PBox.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Stable name for a box in PBodies. The default one is never valid.
+struct PHandle {
+	int slot;
+	unsigned int generation;
+	PHandle(): slot(-1), generation(0) {}
+	PHandle( int _slot, unsigned int _generation ): slot(_slot), generation(_generation) {}
+	bool operator==( const PHandle &_h ) const { return slot == _h.slot && generation == _h.generation; }
+	bool operator!=( const PHandle &_h ) const { return !( *this == _h ); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Packed boxes and the handles pointing at them.
+class PBodies {
+	public:
+		// Every box, packed. Pass to PBox::update() or use update(). Don't
+		// add or remove boxes here directly, the handles won't know.
+		std::vector <PBox> boxes;
+		// sort() every this many update()s, 0(default) for never.
+		int sortevery;
+		// World the boxes are in.
+		PWorld &world;
+
+		PBodies( PWorld &_world = pworld ): sortevery(0), world(_world), sincesort(0) {}
+
+		///////////////////////////////////////////////////////////////////////
+		// Adds a copy of _box at the end.
+		PHandle add( const PBox &_box ) {
+			int slot;
+			if( freeslots.empty() ) {
+				slot = slots.size();
+				slots.push_back( Slot() );
+			}
+			else {
+				slot = freeslots.back();
+				freeslots.pop_back();
+			}
+			slots[slot].index = boxes.size();
+			boxes.push_back( _box );
+			owners.push_back( slot );
+			return PHandle( slot, slots[slot].generation );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Removes _h's box. The last box moves into its place. False if _h
+		// isn't valid.
+		bool remove( const PHandle &_h ) {
+			int idx = index( _h );
+			if( idx < 0 )
+				return false;
+			int last = boxes.size() - 1;
+			PBox::removebox( world, &boxes[0], boxes.size(), idx );
+			boxes.pop_back();
+			// The last box's slot follows it.
+			owners[idx] = owners[last];
+			slots[ owners[idx] ].index = idx;
+			owners.pop_back();
+			// Old handles to this slot stop working.
+			slots[_h.slot].index = -1;
+			slots[_h.slot].generation++;
+			freeslots.push_back( _h.slot );
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// True if _h's box hasn't been removed.
+		bool valid( const PHandle &_h ) const { return index( _h ) >= 0; }
+
+		///////////////////////////////////////////////////////////////////////
+		// Where _h's box is in boxes right now, -1 if it's gone. Changes when
+		// boxes are removed.
+		int index( const PHandle &_h ) const {
+			if( _h.slot < 0 || _h.slot >= (int)slots.size() || slots[_h.slot].generation != _h.generation )
+				return -1;
+			return slots[_h.slot].index;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// _h's box, or 0 if it's gone. Good until the next add() or remove().
+		PBox *get( const PHandle &_h ) {
+			int idx = index( _h );
+			return ( idx >= 0 ) ? &boxes[idx] : 0;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Handle for the box at index _idx. Contacts and pairs name boxes by
+		// index, this gets back to something that lasts.
+		PHandle handle( int _idx ) const {
+			int slot = owners[_idx];
+			return PHandle( slot, slots[slot].generation );
+		}
+
+		int size( void ) const { return boxes.size(); }
+
+		///////////////////////////////////////////////////////////////////////
+		// Puts boxes near each other in space near each other in boxes.
+		// Indices change, handles don't. The octree is rebuilt on the next
+		// update(), so every few hundred steps, not every step.
+		void sort( void ) {
+			sincesort = 0;
+			int numboxes = boxes.size();
+			if( numboxes < 2 )
+				return;
+			order.resize( numboxes );
+			PBox::sortboxes( world, &boxes[0], numboxes, &order[0] );
+			// order[b] is where box b was, its slot comes along.
+			sorted.resize( numboxes );
+			for( int b = 0; b < numboxes; b++ ) {
+				sorted[b] = owners[ order[b] ];
+				slots[ sorted[b] ].index = b;
+			}
+			owners.swap( sorted );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Steps every box(see PBox::update()), sorting them first if it's
+		// time(see sortevery).
+		void update( void ) {
+			if( sortevery > 0 && ++sincesort >= sortevery )
+				sort();
+			if( !boxes.empty() )
+				PBox::update( world, &boxes[0], boxes.size() );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Removes every box. Old handles stop working, and world's octree
+		// is cleared for a fresh start.
+		void clear( void ) {
+			for( unsigned int s = 0; s < slots.size(); s++ ) {
+				if( slots[s].index < 0 ) continue;
+				slots[s].index = -1;
+				slots[s].generation++;
+				freeslots.push_back( s );
+			}
+			boxes.clear();
+			owners.clear();
+			world.tree.clear();
+			world.reset();
+		}
+
+	private:
+		// Where a slot's box is, -1 if free.
+		struct Slot {
+			int index;
+			unsigned int generation;
+			Slot(): index(-1), generation(1) {}
+		};
+		std::vector <Slot> slots;
+		// Slots without a box, used again first.
+		std::vector <int> freeslots;
+		// Slot for every box, same order as boxes.
+		std::vector <int> owners;
+		// update()s since the last sort().
+		int sincesort;
+		// Scratch for sort().
+		std::vector <int> order;
+		std::vector <int> sorted;
+};
+
+#endif // PBODIES_H
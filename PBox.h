@@ -16,6 +16,8 @@
 // - Random forces.
 // - Reactions to collisions.
 // -- Utilizes collision points, rotation angles, and applies other forces.
+// -- Or, with pworld.solver = PSOLVER_IMPULSE, a sequential impulse solver
+//    with angular velocity, friction and warm starting(see PSolver.h).
 //
 // Usage:
 // PBox pboxes[10];
@@ -24,6 +26,12 @@
 // PBox::update( pboxes, 10 );
 // mat4 m = pboxes[0].mat;   // <- Access box transform.
 // draw3dobject( obj, mat ); // <- Draw a box with it.
+//
+// Boxes can be added to the end of the array between update()s. For
+// removing them, or handles that survive it, see PBodies.h. For lots of
+// small scenes stepped at once, see PWorlds.h.
+#ifndef PBOX_H
+#define PBOX_H
 
 // sqrt() and such.
 #include <math.h>
@@ -31,6 +39,12 @@
 // 4x4 Matrix and 3f Vector.
 #include "GLM_Lite.h"
 
+// SSE vectors for the hot loops.
+#include "PMath.h"
+
+// Shared box shapes.
+#include "PShape.h"
+
 // Physics Collision.
 // Holds info about our PBox collisions.
 #include "PCollision.h"
@@ -38,11 +52,21 @@
 // Octree to improve collision detection performance.
 #include "SpocTree.h"
 
+// Step settings and pair/contact scratch.
+#include "PWorld.h"
+
+// Optional trace-event recorder(PBOX_TRACE).
+#include "PTrace.h"
+
 // Useful for determining if certain functions passed/failed.
 vec3 BADVECTOR( -1000.0f, -1000.0f, -1000.0f );
 
-// PBoxes will use this to speed up collision detection.
-SpocTree sptree;
+// Settings, octree and scratch used by PBox::update(). Other worlds(see
+// PWorlds.h) are passed to update() instead.
+PWorld pworld;
+
+// pworld's octree. PBoxes will use this to speed up collision detection.
+SpocTree &sptree = pworld.tree;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Physics Box.
@@ -60,22 +84,35 @@ class PBox {
 		mat4 mat;
 		// Transformed points. pnts[0-8] * mat
 		vec3 pnts[8];
-		// Un-transformed points.
-		// Same as pnts, except no * mat.
-		vec3 pntsu[8];
+		// Index of this box's shape in pshapes. Its corners are the
+		// un-transformed points, same as pnts, except no * mat.
+		int shape;
 		// How fast our box is moving.
 		vec3 vel;
 		// Rate at which the velocity changes.
 		vec3 accel;
+		// How fast our box is spinning. World axis, length is radians per
+		// update(). Only the impulse solver uses it.
+		vec3 angvel;
+		// 1 / mass. 1 by default.
+		float invmass;
+		// 1 / moment of inertia around the box's own x/y/z axes.
+		// Worked out from invmass and the box's size.
+		vec3 invinertia;
 		// Specifies whether this box moves, or
 		// can be moved.
 		bool dynamic;
+		// Collision layers. Two boxes collide if each one's category has a
+		// bit in the other's mask. Layer 1, hitting everything, by default.
+		unsigned int category;
+		unsigned int mask;
+		// Boxes in the same group never collide, whatever their layers. 0 is
+		// no group.
+		int group;
 
 		// These helper variables keep us from creating
 		// objects every frame. Improves performance.
 
-		// Line in triangle result.
-		vec3 lit_tris[2][3];
 		// Collision info for this box.
 		PCollision pc;
 		// Store the largest dimension for this box.
@@ -93,16 +130,8 @@ class PBox {
 		// Can give 0 or more parameters as needed.
 		// Position, width/height/depth, scale, rotation axis, angle.
 		PBox( vec3 _pos = vec3(0, 0, 0), vec3 _whd = vec3(1, 1, 1), vec3 _scale = vec3(1, 1, 1), vec3 _rot = vec3(0, 0, 0), float _angle = 0, bool _dynamic = true ) {
-			// Front Face.
-			pntsu[0] = vec3( -_whd.x / 2, -_whd.y / 2, -_whd.z / 2 );
-			pntsu[1] = vec3( -_whd.x / 2,  _whd.y / 2, -_whd.z / 2 );
-			pntsu[2] = vec3(  _whd.x / 2,  _whd.y / 2, -_whd.z / 2 );
-			pntsu[3] = vec3(  _whd.x / 2, -_whd.y / 2, -_whd.z / 2 );
-			// Back Face.
-			pntsu[4] = vec3(  _whd.x / 2, -_whd.y / 2, _whd.z / 2 );
-			pntsu[5] = vec3( -_whd.x / 2, -_whd.y / 2, _whd.z / 2 );
-			pntsu[6] = vec3( -_whd.x / 2,  _whd.y / 2, _whd.z / 2 );
-			pntsu[7] = vec3(  _whd.x / 2,  _whd.y / 2, _whd.z / 2 );
+			// Shared with every other box this size.
+			shape = pshapes.find( _whd );
 			// Copy untranslated points to translated points.
 			// They aren't translated yet.
 			pointsu( pnts );
@@ -115,29 +144,59 @@ class PBox {
 			// No rotations from reactions have been applied yet.
 			lastrotaxis = vec3( 0, 0, 0 );
 			lastrotangle = 0.0f;
+			// Hits everything.
+			category = 1;
+			mask = 0xFFFFFFFF;
+			group = 0;
+			// Not spinning, unit mass.
+			angvel = vec3( 0, 0, 0 );
+			invmass = 1.0f;
+			calcinertia();
 		}
 
 		/////////////////////////////////////////////////////////////////////////////
-		// Destructor(). Will clear out octree for us.
-		~PBox() { if( sptree.numnodes ) sptree.clear(); }
+		// Switches to shape _shape(see pshapes.find()). Keeps position,
+		// rotation, scale and mass.
+		void setshape( int _shape ) {
+			shape = _shape;
+			settransform( pos, scl, raxis, rangle );
+			largestaxis = calclargeaxis() * 2.0f;
+			calcinertia();
+		}
 
 		/////////////////////////////////////////////////////////////////////////////
 		// Find largest axis of this box. Can only be done after everything has been scaled.
 		float calclargeaxis( void ) {
-			float lgax = -1;
-			mat4 sclmtx = scale( scl );
-			for( int ax = 0; ax < 8; ax++ ) {
-				mat4 tpntmtx = sclmtx * mat4( pntsu[ax] );
-				vec3 npnt;
-				npnt.x = fabs( tpntmtx.columns[3].x );
-				npnt.y = fabs( tpntmtx.columns[3].y );
-				npnt.z = fabs( tpntmtx.columns[3].z );
-				lgax = ( npnt.x > lgax ) ? npnt.x : lgax;
-				lgax = ( npnt.y > lgax ) ? npnt.y : lgax;
-				lgax = ( npnt.z > lgax ) ? npnt.z : lgax;
-			}
-			return lgax;
+			// Every corner is the shape's half sizes, give or take a sign. So
+			// the largest is just the largest scaled half size.
+			const vec3 &half = pshapes[shape].half;
+			float lg = fabs( scl.x * half.x );
+			lg = ( fabs(scl.y * half.y) > lg ) ? fabs( scl.y * half.y ) : lg;
+			lg = ( fabs(scl.z * half.z) > lg ) ? fabs( scl.z * half.z ) : lg;
+			return lg;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Solid box inertia from invmass and the scaled width/height/depth.
+		void calcinertia( void ) {
+			const vec3 &half = pshapes[shape].half;
+			float w = fabs( half.x * 2.0f * scl.x );
+			float h = fabs( half.y * 2.0f * scl.y );
+			float d = fabs( half.z * 2.0f * scl.z );
+			invinertia.x = ( h * h + d * d > 0 ) ? ( 12.0f * invmass ) / ( h * h + d * d ) : 0.0f;
+			invinertia.y = ( w * w + d * d > 0 ) ? ( 12.0f * invmass ) / ( w * w + d * d ) : 0.0f;
+			invinertia.z = ( w * w + h * h > 0 ) ? ( 12.0f * invmass ) / ( w * w + h * h ) : 0.0f;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Set mass. Heavier boxes get pushed around less by the impulse solver.
+		void setmass( float _mass ) {
+			invmass = ( _mass > 0 ) ? 1.0f / _mass : 0.0f;
+			calcinertia();
 		}
+		/////////////////////////////////////////////////////////////////////////////
+		// Getter for mass.
+		float getmass( void ) { return ( invmass > 0 ) ? 1.0f / invmass : 0.0f; }
 
 		/////////////////////////////////////////////////////////////////////////////
 		// Set whether the box moves, or can be moved.
@@ -149,6 +208,23 @@ class PBox {
 		// dynamic's getter.
 		bool getdynamic( void) { return dynamic; }
 
+		/////////////////////////////////////////////////////////////////////////////
+		// Sets category/mask/group. A static box's are baked into its tree, so
+		// change those before the first update() or clear sptree after.
+		void setlayers( unsigned int _category, unsigned int _mask, int _group = 0 ) {
+			category = _category;
+			mask = _mask;
+			group = _group;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// True if the layers and groups let this box and box2 collide.
+		bool canhit( const PBox &box2 ) const {
+			if( group != 0 && group == box2.group )
+				return false;
+			return ( category & box2.mask ) && ( box2.category & mask );
+		}
+
 		/////////////////////////////////////////////////////////////////////////////
 		// Stores position/scale/rotation, rebuilds box transform, and
 		// applies it to the points. Use when you want to update position,
@@ -163,7 +239,7 @@ class PBox {
 			raxis = _rot;
 			rangle = _angle;
 			mat = buildtransform( _pos, _scale, _rot, _angle );
-			transformpoints( pntsu, pnts, mat );
+			transformpoints( pshapes[shape].corners, pnts, mat );
 		}
 		/////////////////////////////////////////////////////////////////////////////
 		// Box's transform's getter.
@@ -208,6 +284,7 @@ class PBox {
 		void setscale( const vec3 &_scale ) {
 			scl = _scale;
 			settransform( pos, scl, raxis, rangle );
+			calcinertia();
 		}
 		/////////////////////////////////////////////////////////////////////////////
 		// Getter for box scale.
@@ -222,6 +299,15 @@ class PBox {
 		// Getter for velocity.
 		vec3 getvel( void ) { return vel; }
 
+		/////////////////////////////////////////////////////////////////////////////
+		// Set angular velocity. World axis, radians per update().
+		void setangvel( const vec3 &_angvel ) {
+			angvel = _angvel;
+		}
+		/////////////////////////////////////////////////////////////////////////////
+		// Getter for angular velocity.
+		vec3 getangvel( void ) { return angvel; }
+
 		/////////////////////////////////////////////////////////////////////////////
 		// Set acceleration.
 		void setaccel( const vec3 &_acceleration ) {
@@ -234,15 +320,17 @@ class PBox {
 		/////////////////////////////////////////////////////////////////////////////
 		// Takes source points, multiples a mat4 against them, stores result in
 		// destination points. Expects 8 points in both source and destination.
-		void transformpoints( vec3 *_srcpnts, vec3 *_destpnts, const mat4 &_mat ) {
-			// Multiply each point by the given matrix.
+		void transformpoints( const vec3 *_srcpnts, vec3 *_destpnts, const mat4 &_mat ) {
+			// Multiply each point by the given matrix. Only its 4th column
+			// comes out of a full mat4 product, so just work that out.
+			pmat34 m( _mat );
 			for( int p = 0; p < 8; p++ )
-				_destpnts[p] = ( (mat4)_mat * mat4(_srcpnts[p]) ).columns[3];
+				_destpnts[p] = m.transformpoint( pvec(_srcpnts[p], 1.0f) ).tovec3();
 		}
 
 		/////////////////////////////////////////////////////////////////////////////
 		// Copies 8 points from one array to another.
-		void copypoints( vec3 *_srcpnts, vec3 *_destpnts ) {
+		void copypoints( const vec3 *_srcpnts, vec3 *_destpnts ) {
 			for( int p = 0; p < 8; p++ )
 				_destpnts[p] = _srcpnts[p];
 		}
@@ -250,7 +338,7 @@ class PBox {
 		/////////////////////////////////////////////////////////////////////////////
 		// Copies the untransformed points into a given point array.
 		void pointsu( vec3 *_points ) {
-			copypoints( pntsu, _points );
+			copypoints( pshapes[shape].corners, _points );
 		}
 
 		/////////////////////////////////////////////////////////////////////////////
@@ -262,10 +350,96 @@ class PBox {
 
 		/////////////////////////////////////////////////////////////////////////////
 		// Checks for a collision between two boxes/cubes.
-		void collision( PCollision &_pc, const PBox &box2 ) {
+		// _stats is where PBOX_STATS counters go, 0 for pworld's.
+		void collision( PCollision &_pc, const PBox &box2, PStepStats *_stats = 0 ) {
 
 			// Initialize collision info first.
-			_pc.numcolpnts = 0;
+			_pc.clear();
+
+			// Quick sphere check first.
+			if( !nearby(box2, _stats) )
+				return;
+
+			// Lines/faces/normals for box2.
+			PBoxGeom geom2;
+			buildgeom( box2.pnts, geom2 );
+
+			// Full line to face checks.
+			collide( _pc, geom2, _stats );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Same as collision(), but box2's lines/faces/normals were built ahead
+		// of time. Static boxes use this so theirs are only built once.
+		void collision( PCollision &_pc, const PBox &box2, const PBoxGeom &_geom2, PStepStats *_stats = 0 ) {
+			_pc.clear();
+			if( !nearby(box2, _stats) )
+				return;
+			collide( _pc, _geom2, _stats );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Box against an infinite plane. Every corner below the plane is a
+		// contact, pushed back onto the plane. Same kind of points as the box
+		// version, so fixpenetration()/reaction() don't care which it was.
+		void collision( PCollision &_pc, const PPlane &_plane, PStepStats *_stats = 0 ) {
+			_pc.clear();
+			// Nowhere near it.
+			if( _plane.distance(pos) > largestaxis ) {
+				PSTATS_ADD( statsfor( _stats ).sphereearlyouts, 1 );
+				return;
+			}
+			PSTATS_ADD( statsfor( _stats ).edgefacetests, 1 );
+			PCPoint raw[8];
+			int numraw = 0;
+			for( int c = 0; c < 8; c++ ) {
+				float depth = _plane.distance( pnts[c] );
+				if( depth >= 0.0f ) continue;
+				vec3 cpnt = pnts[c] - _plane.normal * depth;
+				// Planes have no faces, they all count as face 0.
+				raw[ numraw++ ] = PCPoint( 1, 0, cpnt, _plane.normal );
+			}
+			_pc.setpoints( raw, numraw );
+			PSTATS_ADD( statsfor( _stats ).contactpoints, _pc.numcolpnts );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Box against a heightfield. Every corner over the grid and below the
+		// surface is a contact. The normal is the surface normal under the
+		// corner.
+		void collision( PCollision &_pc, const PHeightfield &_field, PStepStats *_stats = 0 ) {
+			_pc.clear();
+			// Above the highest point, or off the grid.
+			if( pos.y - largestaxis > _field.maxy ||
+				pos.x + largestaxis < _field.origin.x || pos.x - largestaxis > _field.maxx() ||
+				pos.z + largestaxis < _field.origin.z || pos.z - largestaxis > _field.maxz() ) {
+				PSTATS_ADD( statsfor( _stats ).sphereearlyouts, 1 );
+				return;
+			}
+			PSTATS_ADD( statsfor( _stats ).edgefacetests, 1 );
+			PCPoint raw[8];
+			int numraw = 0;
+			for( int c = 0; c < 8; c++ ) {
+				if( pnts[c].y > _field.maxy || !_field.inside(pnts[c].x, pnts[c].z) ) continue;
+				vec3 fnormal;
+				float h = _field.height( pnts[c].x, pnts[c].z, &fnormal );
+				if( pnts[c].y >= h ) continue;
+				raw[ numraw++ ] = PCPoint( 1, 0, vec3(pnts[c].x, h, pnts[c].z), fnormal );
+			}
+			_pc.setpoints( raw, numraw );
+			PSTATS_ADD( statsfor( _stats ).contactpoints, _pc.numcolpnts );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Where member functions put their PBOX_STATS counters. update()
+		// hands them its world's lane, anyone else gets pworld's.
+		static PStepStats &statsfor( PStepStats *_stats ) {
+			return _stats ? *_stats : pworld.lane().stats;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// True if box2 is close enough that the two boxes could be touching.
+		bool nearby( const PBox &box2, PStepStats *_stats = 0 ) {
 
 			//////////////////
 			// Distance Check.
@@ -273,84 +447,121 @@ class PBox {
 				// Before doing ANYTHING, do a simple distance check
 				// to be sure the two boxes are even close enough.
 
-				// Get distance between two boxes.
-				float dist = sqrt( (box2.pos.x - pos.x) * (box2.pos.x - pos.x) +
-					   			   (box2.pos.y - pos.y) * (box2.pos.y - pos.y) +
-								   (box2.pos.z - pos.z) * (box2.pos.z - pos.z)	);
+				// Get squared distance between two boxes. No sqrt(),
+				// comparing squares gives the same answer.
+				float dist2 = (box2.pos.x - pos.x) * (box2.pos.x - pos.x) +
+							  (box2.pos.y - pos.y) * (box2.pos.y - pos.y) +
+							  (box2.pos.z - pos.z) * (box2.pos.z - pos.z);
 
 				// If distance is less than sum of max axis',
 				// we have a potential collision.
-				if( dist > (largestaxis + box2.largestaxis) )
-					return;
+				float reach = largestaxis + box2.largestaxis;
+				if( dist2 > reach * reach ) {
+					PSTATS_ADD( statsfor( _stats ).sphereearlyouts, 1 );
+					return false;
+				}
+				PSTATS_ADD( statsfor( _stats ).edgefacetests, 1 );
 
 			// Distance Check.
 			//////////////////
 
-			///////////////////////////////
-			// 12 lines, 2 collision points.
-			vec3 box1cps[12][2];
-			// 12 lines, 2 end points.
-			vec3 box1lines[12][2];
-			// 6 faces with 4 points.
-			vec3 box1faces[6][4];
-			// 6 xyz normals.
-			vec3 box1fnormals[6];
-			////////////////////////////////
-			// 12 lines, 2 collision points.
-			vec3 box2cps[12][2];
-			// 12 lines, 2 end points.
-			vec3 box2lines[12][2];
-			// 6 faces with 4 points.
-			vec3 box2faces[6][4];
-			// 6 xyz normals.
-			vec3 box2fnormals[6];
-			///////////////////////////////
-			generatelines( pnts, box1lines );
-			generatelines( box2.pnts, box2lines );
-			generatefaces( pnts, box1faces );
-			generatefaces( box2.pnts, box2faces );
+			return true;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// This box as a center, axes and half sizes. Worked out from the
+		// transformed points, the same ones collide() uses.
+		void buildobb( PBoxOBB &_obb ) const {
+			pvec p0( pnts[0] );
+			_obb.center = ( ( p0 + pvec(pnts[7]) ) * 0.5f ).tovec3();
+			// pnts[0] to 3, 1 and 5 are the x, y and z edges.
+			pvec edges[3] = { pvec(pnts[3]) - p0, pvec(pnts[1]) - p0, pvec(pnts[5]) - p0 };
+			pvec extent;
+			for( int ax = 0; ax < 3; ax++ ) {
+				float len = length3( edges[ax] );
+				pvec axis = ( len > 0.0f ) ? edges[ax] / len : pvec();
+				_obb.axes[ax] = axis.tovec3();
+				_obb.half[ax] = len * 0.5f;
+				extent = extent + abs4( axis ) * _obb.half[ax];
+			}
+			_obb.extent = extent.tovec3();
+			_obb.radius = largestaxis;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Builds the 12 lines, 6 faces and 6 face normals for 8 box points.
+		void buildgeom( const vec3 _pnts[8], PBoxGeom &_geom ) {
+			generatelines( _pnts, _geom.lines );
+			generatefaces( _pnts, _geom.faces );
 			// Use our custom method for generating normals.
-			generatefacenormals( box1faces, box1fnormals );
-			generatefacenormals( box2faces, box2fnormals );
+			generatefacenormals( _geom.faces, _geom.fnormals );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Line to face checks between this box and another box's geometry.
+		// Every hit goes in a scratch list, _pc keeps the best 4.
+		void collide( PCollision &_pc, const PBoxGeom &_geom2, PStepStats *_stats = 0 ) {
+			// This box's lines/faces/normals.
+			PBoxGeom geom1;
+			buildgeom( pnts, geom1 );
+			// Both boxes' lines and faces as pvec's, loaded once for all 144
+			// line/face checks.
+			pvec lines1[12][2], lines2[12][2], faces1[6][4], faces2[6][4];
+			for( int l = 0; l < 12; l++ )
+				for( int e = 0; e < 2; e++ ) {
+					lines1[l][e] = pvec( geom1.lines[l][e] );
+					lines2[l][e] = pvec( _geom2.lines[l][e] );
+				}
+			for( int f = 0; f < 6; f++ )
+				for( int c = 0; c < 4; c++ ) {
+					faces1[f][c] = pvec( geom1.faces[f][c] );
+					faces2[f][c] = pvec( _geom2.faces[f][c] );
+				}
+			PCPoint raw[PCOLLISION_MAXRAW];
+			int numraw = 0;
 			///////////////////////////////
 			// Loop through all 12 lines and check for collisions.
 			// Each line can have a max of 2 collisions, because it's
 			// impossible for there to be more.
 			for(int l = 0; l < 12; l++ ) {
-				// Initialize the contact/collision points.
-				box1cps[l][0] = BADVECTOR;
-				box1cps[l][1] = box1cps[l][0];
-				box2cps[l][0] = BADVECTOR;
-				box2cps[l][1] = BADVECTOR;
 				int numbox1cols = 0;
 				int numbox2cols = 0;
 				// Check every face. If a line collides with two faces,
 				// stop checking for that line.
 				for( int f = 0; f < 6; f++ ) {
-					box1cps[l][numbox1cols] = lineinface( box1lines[l], box2faces[f] );
-					box2cps[l][numbox2cols] = lineinface( box2lines[l], box1faces[f] );
-					if( numbox1cols != 2 && ispntvalid(box1cps[l][numbox1cols]) ) {
-						_pc.addpoint( 1, f, box1cps[l][numbox1cols], box2faces[f], box2fnormals[f] );
-						numbox1cols++;
+					pvec cpnt;
+					if( numbox1cols != 2 ) {
+						if( lineinface(lines1[l], faces2[f], cpnt) ) {
+							raw[ numraw++ ] = PCPoint( 1, f, cpnt.tovec3(), _geom2.fnormals[f] );
+							numbox1cols++;
+						}
 					}
-					if( numbox2cols != 2 && ispntvalid(box2cps[l][numbox2cols]) ) {
-						_pc.addpoint( 0, f, box2cps[l][numbox2cols], box1faces[f], box1fnormals[f] );
-						numbox2cols++;
+					if( numbox2cols != 2 ) {
+						if( lineinface(lines2[l], faces1[f], cpnt) ) {
+							raw[ numraw++ ] = PCPoint( 0, f, cpnt.tovec3(), geom1.fnormals[f] );
+							numbox2cols++;
+						}
 					}
 					if( numbox1cols == 2 && numbox2cols == 2 )
 						break;
 				}
 			}
+			_pc.setpoints( raw, numraw );
+			PSTATS_ADD( statsfor( _stats ).contactpoints, _pc.numcolpnts );
 		}
 
 		/////////////////////////////////////////////////////////////////////////////
 		// Give a triangle and it gives a normalized triangle normal.
 		vec3 gettrinormal( const vec3 _tri[3] ) {
+			pvec tri[3] = { pvec(_tri[0]), pvec(_tri[1]), pvec(_tri[2]) };
+			return gettrinormal( tri ).tovec3();
+		}
+		pvec gettrinormal( const pvec _tri[3] ) {
 			// Use triangle vertices to create a normal.
-			vec3 tv1 = (vec3)_tri[0] - (vec3)_tri[1];
-			vec3 tv2 = (vec3)_tri[2] - (vec3)_tri[1];
+			pvec tv1 = _tri[0] - _tri[1];
+			pvec tv2 = _tri[2] - _tri[1];
 			// Cross and normalize to get a normal.
-			return normalize( cross( tv2, tv1 ) );
+			return normalize3( cross3( tv2, tv1 ) );
 		}
 
 		/////////////////////////////////////////////////////////////////////////////
@@ -359,11 +570,10 @@ class PBox {
 			// Create a normal for every face.
 			for( int f = 0; f < 6; f++ ) {
 				// Pull face vertices and create vectors.
-				vec3 fv1 = (vec3)_faces[f][0] - (vec3)_faces[f][1];
-				vec3 fv2 = (vec3)_faces[f][2] - (vec3)_faces[f][1];
+				pvec fv1 = pvec( _faces[f][0] ) - pvec( _faces[f][1] );
+				pvec fv2 = pvec( _faces[f][2] ) - pvec( _faces[f][1] );
 				// Cross and normalize to get a normal.
-				_normals[f] = cross( fv2, fv1 );
-				_normals[f] = normalize( _normals[f] );
+				_normals[f] = normalize3( cross3(fv2, fv1) ).tovec3();
 			}
 		}
 
@@ -371,57 +581,20 @@ class PBox {
 		/////////////////////////////////////////////////////////////////////////////
 		// Accepts 8 points(xyz) for a cube and outputs 4 values per face.
 		void generatefaces( const vec3 _pnts[8], vec3 _faces[6][4] ) {
-			// 1
-			_faces[0][0] = _pnts[0];
-			_faces[0][1] = _pnts[1];
-			_faces[0][2] = _pnts[2];
-			_faces[0][3] = _pnts[3];
-			// 2
-			_faces[1][0] = _pnts[4];
-			_faces[1][1] = _pnts[7];
-			_faces[1][2] = _pnts[6];
-			_faces[1][3] = _pnts[5];
-			// 3
-			_faces[2][0] = _pnts[5];
-			_faces[2][1] = _pnts[6];
-			_faces[2][2] = _pnts[1];
-			_faces[2][3] = _pnts[0];
-			// 4
-			_faces[3][0] = _pnts[3];
-			_faces[3][1] = _pnts[2];
-			_faces[3][2] = _pnts[7];
-			_faces[3][3] = _pnts[4];
-			// 5
-			_faces[4][0] = _pnts[1];
-			_faces[4][1] = _pnts[6];
-			_faces[4][2] = _pnts[7];
-			_faces[4][3] = _pnts[2];
-			// 6
-			_faces[5][0] = _pnts[5];
-			_faces[5][1] = _pnts[0];
-			_faces[5][2] = _pnts[3];
-			_faces[5][3] = _pnts[4];
-
+			// Same corners for every box(see PSHAPE_FACES).
+			for( int f = 0; f < 6; f++ )
+				for( int c = 0; c < 4; c++ )
+					_faces[f][c] = _pnts[ PSHAPE_FACES[f][c] ];
 		}
 
 		/////////////////////////////////////////////////////////////////////////////
 		// Takes 8 points for box/cube and  creates 12 lines, each with two xyz's.
 		void generatelines( const vec3 _pnts[8], vec3 _lines[12][2] ) {
-			for( int l = 0, p = 0; l < 7; l++, p++ ) {
-				_lines[l][0] = _pnts[p];
-				_lines[l][1] = _pnts[p + 1];
-			}
-			for( int l2 = 7, p2 = 0; l2 < 12; l2++, p2++ ) {
-				_lines[l2][0] = _pnts[p2];
-				_lines[l2][1] = _pnts[p2 + 5];
+			// Same corners for every box(see PSHAPE_LINES).
+			for( int l = 0; l < 12; l++ ) {
+				_lines[l][0] = _pnts[ PSHAPE_LINES[l][0] ];
+				_lines[l][1] = _pnts[ PSHAPE_LINES[l][1] ];
 			}
-			//
-			_lines[10][0] = _pnts[0];
-			_lines[10][1] = _pnts[3];
-			//
-			_lines[11][0] = _pnts[7];
-			_lines[11][1] = _pnts[4];
-
 		}
 
 		/////////////////////////////////////////////////////////////////////////////
@@ -446,11 +619,22 @@ class PBox {
 		// Can call ispntvalid(vec3()) to determine instead of
 		// checking for -1000.
 		vec3 lineinface( const vec3 _line[2], const vec3 _face[4] ) {
-			generatetris( _face, lit_tris );
-			vec3 cpnt = lineintri( _line, lit_tris[0] );
-			if( ispntvalid(cpnt) ) return cpnt;
-			cpnt = lineintri( _line, lit_tris[1] );
-			return cpnt;
+			pvec line[2] = { pvec(_line[0]), pvec(_line[1]) };
+			pvec face[4] = { pvec(_face[0]), pvec(_face[1]), pvec(_face[2]), pvec(_face[3]) };
+			pvec cpnt;
+			return lineinface( line, face, cpnt ) ? cpnt.tovec3() : BADVECTOR;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// lineinface() on pvec's, what collide() uses. Returns true and sets
+		// _pnt if the line hits the face.
+		bool lineinface( const pvec _line[2], const pvec _face[4], pvec &_pnt ) {
+			// On the stack, not in the box, so two threads can check
+			// the same box.
+			pvec tri1[3] = { _face[0], _face[1], _face[2] };
+			if( lineintri(_line, tri1, _pnt) ) return true;
+			pvec tri2[3] = { _face[0], _face[2], _face[3] };
+			return lineintri( _line, tri2, _pnt );
 		}
 
 		/////////////////////////////////////////////////////////////////////////////
@@ -459,27 +643,37 @@ class PBox {
 		// vec3(-1000.0f, -1000.0f, -1000.0f). Check with
 		// ispntvalid(vec3()).
 		vec3 lineintri( const vec3 _line[2], const vec3 _tri[3] ) {
+			pvec line[2] = { pvec(_line[0]), pvec(_line[1]) };
+			pvec tri[3] = { pvec(_tri[0]), pvec(_tri[1]), pvec(_tri[2]) };
+			pvec cpnt;
+			return lineintri( line, tri, cpnt ) ? cpnt.tovec3() : BADVECTOR;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// lineintri() on pvec's. Returns true and sets _pnt if the line hits
+		// the triangle.
+		bool lineintri( const pvec _line[2], const pvec _tri[3], pvec &_pnt ) {
 
 			// Get normal of triangle.
-			vec3 trinorm = gettrinormal( _tri );
+			pvec trinorm = gettrinormal( _tri );
 
 			// The line's normal/vector.
-			vec3 linenorm = (vec3)_line[1] - (vec3)_line[0];
+			pvec linenorm = _line[1] - _line[0];
 
 			// Save length of line vector/normal.
-			float linelen = magnitude( linenorm );
+			float linelen = length3( linenorm );
 
 			// Now normalize. it.
-			linenorm = normalize( linenorm );
+			linenorm = normalize3( linenorm );
 
 			// Dot between start of line and triangle normal.
-			float dot_start_offset = dot( _line[0], trinorm );
+			float dot_start_offset = dot3( _line[0], trinorm );
 
 			// Dot between line normal and triangle normal.
-			float dot_lnnorm_trinorm = dot( linenorm, trinorm );
+			float dot_lnnorm_trinorm = dot3( linenorm, trinorm );
 
 			// Dot of tri normal and first tri vertice.
-			float dot_plane_offset = dot( trinorm, _tri[0] );
+			float dot_plane_offset = dot3( trinorm, _tri[0] );
 
 			// How much to scale the line vector.
 			float linescale = ( dot_plane_offset - dot_start_offset ) / ( dot_lnnorm_trinorm ? dot_lnnorm_trinorm : 1 );
@@ -489,43 +683,39 @@ class PBox {
 			// the length of the line, there is no way it's
 			// touching the triangle.
 			if( linescale < 0 || linescale > linelen )
-				return BADVECTOR;
+				return false;
 
 			// Scale line normal.
 			linenorm = linenorm * linescale;
 
 			// Add scaled normal to line start.
-			vec3 checkpoint = (vec3)_line[0] + linenorm;
-
-			// If this point is in the triangle, return it.
-			if( pointintri(checkpoint, _tri) )
-				return checkpoint;
+			_pnt = _line[0] + linenorm;
 
-			// If we made it here, the line is NOT colliding with the triangle.
-			return BADVECTOR;
+			// If this point is in the triangle, it's a hit. If not, the line
+			// is NOT colliding with the triangle.
+			return pointintri( _pnt, _tri );
 		}
 
 		/////////////////////////////////////////////////////////////////////////////
 		// Checks for collision/intersection between point and triangle.
 		bool pointintri( const vec3 &_pnt, const vec3 _tri[3] ) {
+			pvec tri[3] = { pvec(_tri[0]), pvec(_tri[1]), pvec(_tri[2]) };
+			return pointintri( pvec(_pnt), tri );
+		}
+		bool pointintri( const pvec &_pnt, const pvec _tri[3] ) {
 
 			// Sum of angles between vectors from point to tri vertices.
 			float degs = 0.0f;
 
-			// Vectors between point and tri vertices.
-			vec3 v1 = (vec3)_pnt - (vec3)_tri[0];
-			vec3 v2 = (vec3)_pnt - (vec3)_tri[1];
-			vec3 v3 = (vec3)_pnt - (vec3)_tri[2];
-
-			// Normalize the vectors.
-			v1 = normalize( v1 );
-			v2 = normalize( v2 );
-			v3 = normalize( v3 );
+			// Vectors between point and tri vertices, normalized.
+			pvec v1 = normalize3( _pnt - _tri[0] );
+			pvec v2 = normalize3( _pnt - _tri[1] );
+			pvec v3 = normalize3( _pnt - _tri[2] );
 
 			// Add up angles between vectors.
-			degs += acos( dot(v1, v2) );
-			degs += acos( dot(v2, v3) );
-			degs += acos( dot(v3, v1) );
+			degs += acos( dot3(v1, v2) );
+			degs += acos( dot3(v2, v3) );
+			degs += acos( dot3(v3, v1) );
 
 			// If the sum of the angles is 2 * PI, the point is in the triangle.
 			if( fabs(degs - 2 * 3.141592654) < 0.005f )
@@ -550,11 +740,7 @@ class PBox {
 		// Make sure axis is normalized.
 		// Takes vec3 and degrees.
 		vec3 axis2quat( const vec3 &_axis, float _angle ) {
-			_angle = (_angle * 3.141592f) / 180.0f;
-			return vec3( _axis.x * sin( _angle / 2 ), // qx
-						 _axis.y * sin( _angle / 2 ), // qy
-						 _axis.z * sin( _angle / 2 ), // qz
-						 cos(_angle / 2) );			  // qw
+			return pquat( pvec(_axis), _angle ).q.tovec3();
 		}
 		/////////////////////////////////////////////////////////////////////////////
 		//
@@ -562,26 +748,32 @@ class PBox {
 		// Our _quat is just a vec3
 		// Returns axis and angle(in degrees).
 		void quat2axis( const vec3 &_quat, vec3 &_axis, float &_angle ) {
-			_angle = ( (2 * acos( _quat.w )) * 180.0f ) / 3.141592f;
-			_axis.x = _quat.x / sqrt( 1 - _quat.w * _quat.w );
-			_axis.y = _quat.y / sqrt( 1 - _quat.w * _quat.w );
-			_axis.z = _quat.z / sqrt( 1 - _quat.w * _quat.w );
-			_axis = normalize( _axis );
+			pvec axis;
+			pquat( _quat.x, _quat.y, _quat.z, _quat.w ).toaxisangle( axis, _angle );
+			_axis = vec3( axis.x(), axis.y(), axis.z(), _axis.w );
 		}
 		/////////////////////////////////////////////////////////////////////////////
 		//
-		void fixpenetration( const PCollision &pc ) {
+		// Direction to push this box out of whatever pc says it's hitting.
+		// Unit length.
+		vec3 contactnormal( const PCollision &pc ) {
 			// Get the average normal from all faces involved.
 			vec3 box1avgnorm;
 			vec3 box2avgnorm;
-			((PCollision)pc).averagenormals1f( box1avgnorm, box2avgnorm );
+			pc.averagenormals1f( box1avgnorm, box2avgnorm );
 			// A bit of a hack. It's possible for the first box to be "bigger" than
 			// the second. This can introduce a scenario where NONE of box1 lines are
 			// are touching box2 faces, which generates NO box2 face collisions.
 			// Here we choose to use box1 faces/normals if box2 doesn't have anything
 			// useful.
 			vec3 anscaled = ( magnitude(box2avgnorm) > 0 ? box2avgnorm : box1avgnorm * -1);
-			anscaled = normalize( anscaled );
+			return normalize( anscaled );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		void fixpenetration( const PCollision &pc ) {
+			vec3 anscaled = contactnormal( pc );
 			//anscaled = anscaled * ( (pc.numcolpnts < 6) ? 0.1f : 0.05f );
 			// Apply to this box's position.
 			setpos( pos + anscaled * 0.02f );
@@ -636,7 +828,7 @@ class PBox {
 		//
 		void reaction( const PCollision &pc ) {
 			// Get average contact point.
-			vec3 avgpnt = ((PCollision)(pc)).averagepoint();
+			vec3 avgpnt = pc.averagepoint();
 			// Get vector from box center-point to
 			// contact point.
 			vec3 contactvector = normalize( avgpnt - pos );
@@ -681,12 +873,130 @@ class PBox {
 			}
 		}
 
+		/////////////////////////////////////////////////////////////////////////////
+		// Spins the box by _angvel(world axis, radians) for one update().
+		void applyangvel( const vec3 &_angvel ) {
+			double angle = magnitude( _angvel );
+			if( angle < 0.0000001 ) return;
+			// Compose as quaternions, in doubles. Per step rotations are tiny,
+			// multaa() snaps them and float quaternions round them away.
+			double s = sin( angle / 2 ) / angle;
+			double sx = _angvel.x * s, sy = _angvel.y * s, sz = _angvel.z * s;
+			double sw = cos( angle / 2 );
+			double cx = 0, cy = 0, cz = 0, cw = 1;
+			double axlen = magnitude( raxis );
+			if( axlen > 0 ) {
+				double half = ( rangle * 3.14159265358979 ) / 360.0;
+				cx = raxis.x * sin( half ) / axlen;
+				cy = raxis.y * sin( half ) / axlen;
+				cz = raxis.z * sin( half ) / axlen;
+				cw = cos( half );
+			}
+			// spin * current.
+			double qx = sw * cx + sx * cw + sy * cz - sz * cy;
+			double qy = sw * cy - sx * cz + sy * cw + sz * cx;
+			double qz = sw * cz + sx * cy - sy * cx + sz * cw;
+			double qw = sw * cw - sx * cx - sy * cy - sz * cz;
+			// Back to axis-angle.
+			double sinhalf = sqrt( qx * qx + qy * qy + qz * qz );
+			if( sinhalf < 0.000000001 ) {
+				setrot( raxis, 0 );
+				return;
+			}
+			float nangle = (float)( ( 2.0 * atan2(sinhalf, qw) * 180.0 ) / 3.14159265358979 );
+			setrot( vec3((float)(qx / sinhalf), (float)(qy / sinhalf), (float)(qz / sinhalf), 1), nangle );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// World space inverse inertia times _v. Static boxes don't turn.
+		vec3 invinertiamul( const vec3 &_v ) const {
+			if( !dynamic ) return vec3( 0, 0, 0 );
+			// mat's first 3 columns are the box's axes, scaled.
+			pvec v( _v );
+			pvec ax = normalize3( pvec(mat.columns[0]) );
+			pvec ay = normalize3( pvec(mat.columns[1]) );
+			pvec az = normalize3( pvec(mat.columns[2]) );
+			return ( ax * ( dot3(ax, v) * invinertia.x ) +
+					 ay * ( dot3(ay, v) * invinertia.y ) +
+					 az * ( dot3(az, v) * invinertia.z ) ).tovec3();
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// World direction/offset _v in this box's own frame. Undoes the
+		// rotation, not the scale.
+		vec3 tolocal( const vec3 &_v ) const {
+			pvec v( _v );
+			return vec3( dot3(normalize3(pvec(mat.columns[0])), v),
+						 dot3(normalize3(pvec(mat.columns[1])), v),
+						 dot3(normalize3(pvec(mat.columns[2])), v) );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// How far this box sinks into ground g along _normal. Planes first,
+		// then heightfields, like collideground().
+		float grounddepth( const PWorld &_world, int _g, const vec3 &_normal ) {
+			int numplanes = _world.planes.size();
+			float depth = 0.0f;
+			for( int c = 0; c < 8; c++ ) {
+				float d;
+				if( _g < numplanes )
+					d = -_world.planes[_g].distance( pnts[c] );
+				else {
+					const PHeightfield &field = _world.heightfields[_g - numplanes];
+					if( !field.inside(pnts[c].x, pnts[c].z) ) continue;
+					d = ( field.height(pnts[c].x, pnts[c].z) - pnts[c].y ) * _normal.y;
+				}
+				depth = ( d > depth ) ? d : depth;
+			}
+			return depth;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// How far box2 sinks into this box along _normal(pointing from box2
+		// toward this box).
+		float boxdepth( const PBox &box2, const vec3 &_normal ) {
+			pvec normal( _normal );
+			float amin = dot3( normal, pvec(pnts[0]) );
+			float bmax = dot3( normal, pvec(box2.pnts[0]) );
+			for( int c = 1; c < 8; c++ ) {
+				float da = dot3( normal, pvec(pnts[c]) );
+				float db = dot3( normal, pvec(box2.pnts[c]) );
+				amin = ( da < amin ) ? da : amin;
+				bmax = ( db > bmax ) ? db : bmax;
+			}
+			return ( bmax - amin > 0 ) ? bmax - amin : 0.0f;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Of the 6 face directions of both boxes, finds the one box2 sinks
+		// into this box the least along. That's the way to push them apart.
+		// _normal points from box2 toward this box. Returns the depth.
+		// The averaged contact point normals(contactnormal()) are fine for a
+		// nudge, but tip sideways when edges lie flat on faces.
+		float facenormal( const PBox &box2, vec3 &_normal ) {
+			vec3 between = pos - box2.pos;
+			float best = -1.0f;
+			for( int ax = 0; ax < 6; ax++ ) {
+				const mat4 &m = ( ax < 3 ) ? mat : box2.mat;
+				vec3 axis = normalize( m.columns[ax % 3] );
+				axis.w = 0;
+				if( dot(axis, between) < 0 )
+					axis = axis * -1;
+				float depth = boxdepth( box2, axis );
+				if( best < 0 || depth < best ) {
+					best = depth;
+					_normal = axis;
+				}
+			}
+			return best;
+		}
+
 		//
 		static void bucketcol( PBox *pboxes, Spocket *snode, int sidx, int &colz ) {
 			int numindices = snode->numsindices;
 			for( int s = 0; s < numindices; s++ ) {
 				int curnodeidx = snode->sindices[s];
-				if( curnodeidx == sidx ) continue;
+				if( curnodeidx == sidx || !pboxes[sidx].canhit(pboxes[curnodeidx]) ) continue;
 
 				// Finally do collision check.
 				pboxes[sidx].collision( pboxes[sidx].pc, pboxes[curnodeidx] );
@@ -722,6 +1032,1114 @@ class PBox {
 
 		} // bucketcol()
 
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// fixpenetration() and then reaction(). Times both when PBOX_STATS is
+		// defined.
+		void respond( const PCollision &_pc, PStepStats *_stats = 0 ) {
+			PSTATS_BEGIN( pentimer );
+			fixpenetration( _pc );
+			PSTATS_END( pentimer, statsfor( _stats ).penetration );
+			PSTATS_BEGIN( reacttimer );
+			reaction( _pc );
+			PSTATS_END( reacttimer, statsfor( _stats ).reaction );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Works out contact events, clears the octree buckets for the next
+		// step and finishes off stats. _allocs is pheapallocs when the step
+		// started.
+		static void endstep( PWorld &_world, unsigned long long _allocs ) {
+			if( _world.contactevents )
+				_world.buildevents();
+			PSTATS_BEGIN( resettimer );
+            _world.tree.reset();
+			PSTATS_END( resettimer, _world.stats.treerefresh );
+			PSTATS_SET( _world.stats.nodesvisited, _world.tree.nodesvisited + _world.statictree.nodesvisited );
+			PSTATS_SET( _world.stats.heapallocs, (unsigned int)(pheapallocs - _allocs) );
+			// Counters and narrowphase time from every thread.
+			for( unsigned int l = 0; l < _world.lanes.size(); l++ )
+				PSTATS_ADD( _world.stats, _world.lanes[l].stats );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Puts every static(non-dynamic) box in pworld.statictree and builds its
+		// lines/faces/normals once. update() calls this whenever it builds sptree.
+		static void buildstatics( PWorld &_world, PBox *pboxes, int _numboxes ) {
+			_world.clearstatics();
+			_world.staticslots.assign( _numboxes, -1 );
+			for( int pb = 0; pb < _numboxes; pb++ )
+				if( !pboxes[pb].dynamic )
+					slotstatic( _world, pboxes, pb );
+			// Usually only a handful of static boxes, so a shallow tree does.
+			if( !_world.staticboxes.empty() )
+				_world.statictree.buildtree( 3, vec3(150, 150, 150), vec3(10.0f, 0.0f, 10.0f) );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Gives static box _idx a slot, its lines/faces/normals and a sphere in
+		// pworld.statictree. The sphere isn't placed yet.
+		static void slotstatic( PWorld &_world, PBox *pboxes, int _idx ) {
+			_world.staticslots[_idx] = _world.staticboxes.size();
+			_world.staticboxes.push_back( _idx );
+			_world.staticgeoms.push_back( PBoxGeom() );
+			pboxes[_idx].buildgeom( pboxes[_idx].pnts, _world.staticgeoms.back() );
+			_world.statictree.addsphere( pboxes[_idx].pos, pboxes[_idx].largestaxis, pboxes[_idx].category );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Static box _idx, added after buildstatics(). Just placed in
+		// pworld.statictree, unless it's the first.
+		static void addstatic( PWorld &_world, PBox *pboxes, int _idx ) {
+			slotstatic( _world, pboxes, _idx );
+			if( _world.statictree.numnodes )
+				_world.statictree.placesphere( _world.staticboxes.size() - 1 );
+			else
+				_world.statictree.buildtree( 3, vec3(150, 150, 150), vec3(10.0f, 0.0f, 10.0f) );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Takes static box _idx out of pworld.statictree. The last slot moves
+		// into its place.
+		static void removestatic( PWorld &_world, int _idx ) {
+			int slot = _world.staticslots[_idx];
+			int last = _world.staticboxes.size() - 1;
+			_world.statictree.removesphere( slot );
+			_world.staticboxes[slot] = _world.staticboxes[last];
+			_world.staticgeoms[slot] = _world.staticgeoms[last];
+			_world.staticslots[ _world.staticboxes[slot] ] = slot;
+			_world.staticboxes.pop_back();
+			_world.staticgeoms.pop_back();
+			_world.staticslots[_idx] = -1;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Boxes added to the end of the array since sptree was built get a
+		// sphere, and static ones go in pworld.statictree. Boxes dropped off
+		// the end come out. update() calls this whenever the box count
+		// changes.
+		static void syncboxes( PWorld &_world, PBox *pboxes, int _numboxes ) {
+			while( (int)_world.tree.slist.size() > _numboxes ) {
+				int pb = _world.tree.slist.size() - 1;
+				if( _world.staticslots[pb] >= 0 )
+					removestatic( _world, pb );
+				_world.tree.removesphere( pb );
+				_world.staticslots.pop_back();
+			}
+			for( int pb = _world.tree.slist.size(); pb < _numboxes; pb++ ) {
+				_world.tree.addsphere( pboxes[pb].pos, pboxes[pb].largestaxis, pboxes[pb].category );
+				_world.staticslots.push_back( -1 );
+				if( !pboxes[pb].dynamic )
+					addstatic( _world, pboxes, pb );
+			}
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Removes box _idx from an array of _numboxes by moving the last box
+		// into its place. Call it between update()s, then drop the last box.
+		// Its sphere, static slot and last step's contacts and separating
+		// axes(see PWorld::removebox()) follow it, so nothing is rebuilt.
+		// PBodies(see PBodies.h) does this for you.
+		static void removebox( PWorld &_world, PBox *pboxes, int _numboxes, int _idx ) {
+			int last = _numboxes - 1;
+			if( _world.tree.numnodes ) {
+				syncboxes( _world, pboxes, _numboxes );
+				if( _world.staticslots[_idx] >= 0 )
+					removestatic( _world, _idx );
+				int slot = _world.staticslots[last];
+				_world.staticslots[_idx] = slot;
+				if( slot >= 0 )
+					_world.staticboxes[slot] = _idx;
+				_world.staticslots.pop_back();
+				_world.tree.removesphere( _idx );
+			}
+			_world.removebox( _idx, _numboxes );
+			if( _idx != last )
+				pboxes[_idx] = pboxes[last];
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Same, for boxes in pworld.
+		static void removebox( PBox *pboxes, int _numboxes, int _idx ) {
+			removebox( pworld, pboxes, _numboxes, _idx );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Reorders an array of _numboxes boxes along a Morton curve through
+		// their positions, so boxes near each other in space are near each
+		// other in memory. Pairs and contacts then walk the array instead of
+		// jumping around it. Call it between update()s, every few hundred
+		// steps is plenty. Boxes don't travel far between sorts.
+		// Last step's contacts and separating axes follow their boxes(see
+		// PWorld::reorderboxes()), except for pairs whose order flipped. The
+		// octree is rebuilt on the next update().
+		// _order, if given, gets the old index of every box. PBodies(see
+		// PBodies.h) uses it to keep its handles right.
+		static void sortboxes( PWorld &_world, PBox *pboxes, int _numboxes, int *_order = 0 ) {
+			if( _numboxes < 2 )
+				return;
+			// Scratch from this step's arena, gone a step from now.
+			PArena &arena = _world.frames[ _world.frame ];
+			vec3 lo = pboxes[0].pos;
+			vec3 hi = pboxes[0].pos;
+			for( int pb = 1; pb < _numboxes; pb++ ) {
+				const vec3 &p = pboxes[pb].pos;
+				lo = vec3( (p.x < lo.x) ? p.x : lo.x, (p.y < lo.y) ? p.y : lo.y, (p.z < lo.z) ? p.z : lo.z );
+				hi = vec3( (p.x > hi.x) ? p.x : hi.x, (p.y > hi.y) ? p.y : hi.y, (p.z > hi.z) ? p.z : hi.z );
+			}
+			// Same scale on every axis, so the curve's cells are cubes.
+			vec3 size = hi - lo;
+			float extent = ( size.x > size.y ) ? size.x : size.y;
+			extent = ( size.z > extent ) ? size.z : extent;
+			float scale = ( extent > 0.0f ) ? ( SpocTree::KEYCELLS - 1 ) / extent : 0.0f;
+			SpocKey *keys = arena.alloc<SpocKey>( _numboxes );
+			for( int pb = 0; pb < _numboxes; pb++ ) {
+				vec3 cell = pboxes[pb].pos - lo;
+				keys[pb].key = ( SpocTree::spreadbits( SpocTree::keycell(cell.x * scale) ) << 2 ) |
+							   ( SpocTree::spreadbits( SpocTree::keycell(cell.y * scale) ) << 1 ) |
+								 SpocTree::spreadbits( SpocTree::keycell(cell.z * scale) );
+				keys[pb].sidx = pb;
+			}
+			// Ties keep their order, same boxes sort the same way every time.
+			std::sort( keys, keys + _numboxes, []( const SpocKey &_a, const SpocKey &_b ) {
+				return ( _a.key != _b.key ) ? ( _a.key < _b.key ) : ( _a.sidx < _b.sidx );
+			} );
+			int *order = _order ? _order : arena.alloc<int>( _numboxes );
+			bool sorted = true;
+			for( int pb = 0; pb < _numboxes; pb++ ) {
+				order[pb] = keys[pb].sidx;
+				sorted = sorted && ( order[pb] == pb );
+			}
+			if( sorted )
+				return;
+
+			// Move boxes a cycle at a time, one spare box for each.
+			bool *done = arena.alloc<bool>( _numboxes );
+			for( int pb = 0; pb < _numboxes; pb++ )
+				done[pb] = false;
+			for( int pb = 0; pb < _numboxes; pb++ ) {
+				if( done[pb] ) continue;
+				PBox spare = pboxes[pb];
+				int to = pb;
+				while( order[to] != pb ) {
+					pboxes[to] = pboxes[ order[to] ];
+					done[to] = true;
+					to = order[to];
+				}
+				pboxes[to] = spare;
+				done[to] = true;
+			}
+			_world.reorderboxes( order, _numboxes );
+			_world.tree.clear();
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Same, for boxes in pworld.
+		static void sortboxes( PBox *pboxes, int _numboxes, int *_order = 0 ) {
+			sortboxes( pworld, pboxes, _numboxes, _order );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Finds the static boxes that might touch box _idx. Results end up in
+		// pworld.found as indices into pworld.staticboxes. Subtrees with none
+		// of the layers in its mask are skipped.
+		static void findstatics( PWorld &_world, PBox *pboxes, int _idx ) {
+			_world.found.clear();
+			_world.statictree.query( pboxes[_idx].pos, pboxes[_idx].largestaxis, _world.found, pboxes[_idx].mask );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Collides dynamic box _idx with every static box near it and reacts.
+		// Static boxes never move, so only _idx responds.
+		static void collidestatics( PWorld &_world, PBox *pboxes, int _idx ) {
+			findstatics( _world, pboxes, _idx );
+			int numfound = _world.found.size();
+			for( int f = 0; f < numfound; f++ ) {
+				int slot = _world.found[f];
+				int idx2 = _world.staticboxes[slot];
+				if( !pboxes[_idx].canhit(pboxes[idx2]) ) {
+					PSTATS_ADD( _world.stats.layerskips, 1 );
+					continue;
+				}
+				PTRACE_SCOPE_PAIR( "pair", _idx, idx2 );
+				PSTATS_BEGIN( coltimer );
+				pboxes[_idx].collision( pboxes[_idx].pc, pboxes[idx2], _world.staticgeoms[slot], &_world.lane().stats );
+				PSTATS_END( coltimer, _world.stats.narrowphase );
+				if( pboxes[_idx].pc.numcolpnts > 0 ) {
+					touch( _world, _idx, idx2, pboxes[_idx].pc );
+					pboxes[_idx].respond( pboxes[_idx].pc, &_world.lane().stats );
+				}
+			}
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Collides dynamic box _idx with every plane and heightfield and reacts.
+		static void collideground( PWorld &_world, PBox *pboxes, int _idx ) {
+			PBox &box = pboxes[_idx];
+			int numplanes = _world.planes.size();
+			int numfields = _world.heightfields.size();
+			for( int g = 0; g < numplanes + numfields; g++ ) {
+				PSTATS_BEGIN( coltimer );
+				if( g < numplanes )
+					box.collision( box.pc, _world.planes[g], &_world.lane().stats );
+				else
+					box.collision( box.pc, _world.heightfields[g - numplanes], &_world.lane().stats );
+				PSTATS_END( coltimer, _world.stats.narrowphase );
+				if( box.pc.numcolpnts > 0 ) {
+					touch( _world, _idx, -1 - g, box.pc );
+					box.respond( box.pc, &_world.lane().stats );
+				}
+			}
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Nudging path. Box _idx's contacts in _pc are with _other, for
+		// pworld.events.
+		static void touch( PWorld &_world, int _idx, int _other, const PCollision &_pc ) {
+			if( _world.contactevents )
+				_world.touch( _idx, _other, _pc.colpnts, _pc.numcolpnts );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Stores box _idx's ground contacts for the deterministic path.
+		// Doesn't move anything.
+		static void storeground( PWorld &_world, PBox *pboxes, int _idx, PLane &_lane ) {
+			PBox &box = pboxes[_idx];
+			int numplanes = _world.planes.size();
+			int numfields = _world.heightfields.size();
+			PCollision pc;
+			for( int g = 0; g < numplanes + numfields; g++ ) {
+				if( g < numplanes )
+					box.collision( pc, _world.planes[g], &_lane.stats );
+				else
+					box.collision( pc, _world.heightfields[g - numplanes], &_lane.stats );
+				_lane.addcontact( _idx, -1 - g, pc );
+			}
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Deterministic half of update(). update() has already run
+		// collidepairs() and collidegrounds().
+		// 1. Collect every pair sharing a bucket, plus every dynamic/static
+		//    pair, and sort by pair id(collidepairs()).
+		// 2. Run collision() for both sides of every pair, then every dynamic
+		//    box against the ground in box order(collidepairs() and
+		//    collidegrounds()). Nothing moves yet, so every pair sees the same
+		//    box state no matter what order(or thread) it's checked in.
+		// 3. Apply responses in pair order. Each box's pushes and rotations are
+		//    always summed in the same order, so the floating-point result is
+		//    the same every run.
+		// 1 and 2 run as jobs, this does 3.
+		// A response only moves the box that owns the contact, so boxes are
+		// handed out to the threads, each box's contacts still in pair order.
+		static void updatepairs( PWorld &_world, PBox *pboxes, int _numboxes ) {
+			_world.takecontacts();
+
+			// Contacts by box, pair order kept.
+			int numcontacts = _world.contacts.size();
+			PArenaArray <int> &starts = _world.batchstarts;
+			PArenaArray <int> &order = _world.batchorder;
+			starts.assign( _numboxes + 1, 0 );
+			for( int c = 0; c < numcontacts; c++ )
+				starts[ _world.contacts[c].box + 1 ]++;
+			for( int pb = 0; pb < _numboxes; pb++ )
+				starts[pb + 1] += starts[pb];
+			order.resize( numcontacts );
+			for( int c = 0; c < numcontacts; c++ )
+				order[ starts[ _world.contacts[c].box ]++ ] = c;
+			// Filling moved every start up to the next box's, put them back.
+			for( int pb = _numboxes; pb > 0; pb-- )
+				starts[pb] = starts[pb - 1];
+			starts[0] = 0;
+
+			// Responses, in pair order per box.
+			PTRACE_SCOPE( "respond" );
+			_world.jobs.parallelfor( _numboxes, [&]( int _pb, int ) {
+				PBox &box = pboxes[_pb];
+				for( int c = starts[_pb]; c < starts[_pb + 1]; c++ ) {
+					// Goes in pc, so it's left with the last contact like the
+					// regular path.
+					_world.getcontact( order[c], box.pc );
+					box.respond( box.pc, &_world.lane().stats );
+				}
+			}, BOXGRAIN );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Fills pworld.pairs with every pair sharing a bucket, plus every
+		// dynamic/static pair, sorted by pair id.
+		// _allnodes looks at every node the box overlaps instead of just its
+		// bucket. Slower, but finds pairs whose spheres ended up in different
+		// levels of the tree(the bucket doesn't).
+		static void gatherpairs( PWorld &_world, PBox *pboxes, int _numboxes, bool _allnodes = false ) {
+			// A box's bucket holds the boxes it can touch.
+			PTRACE_SCOPE( "pairs" );
+			for( int pb = 0; pb < _numboxes; pb++ ) {
+				// Static boxes aren't in sptree, dynamic boxes find them.
+				if( !pboxes[pb].dynamic ) continue;
+				if( _allnodes ) {
+					PSTATS_BEGIN( buckettimer );
+					_world.found.clear();
+					_world.tree.query( pboxes[pb].pos, pboxes[pb].largestaxis, _world.found, pboxes[pb].mask );
+					PSTATS_END( buckettimer, _world.stats.getbucket );
+					// Both sides find the pair, sortpairs() drops the copy.
+					int numfound = _world.found.size();
+					for( int f = 0; f < numfound; f++ )
+						if( _world.found[f] != pb )
+							addpair( _world, pboxes, pb, _world.found[f] );
+				}
+				else {
+					PSTATS_BEGIN( buckettimer );
+					Spocket *bucket = _world.tree.getbucket( pb );
+					PSTATS_END( buckettimer, _world.stats.getbucket );
+					// No bucket if the box is somewhere the tree couldn't grow to,
+					// or nothing worth looking at if none of it is in our layers.
+					int numsidx = ( bucket && (_world.tree.nodelayers(bucket) & pboxes[pb].mask) ) ? bucket->numsindices : 0;
+					for( int cidx = 0; cidx < numsidx; cidx++ ) {
+						int idx2 = bucket->sindices[cidx];
+						// Each pair shows up from both boxes' side. Keep one.
+						if( idx2 > pb )
+							addpair( _world, pboxes, pb, idx2 );
+					}
+				}
+				findstatics( _world, pboxes, pb );
+				int numfound = _world.found.size();
+				for( int f = 0; f < numfound; f++ )
+					addpair( _world, pboxes, pb, _world.staticboxes[ _world.found[f] ] );
+			}
+			_world.sortpairs();
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Adds pair _idx/_idx2 to pworld.pairs, unless their layers or group
+		// say they can't collide.
+		static void addpair( PWorld &_world, PBox *pboxes, int _idx, int _idx2 ) {
+			if( pboxes[_idx].canhit(pboxes[_idx2]) )
+				_world.addpair( _idx, _idx2 );
+			else
+				PSTATS_ADD( _world.stats.layerskips, 1 );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Runs collision() for both sides of a pair and stores the sides that
+		// have points and can move. Doesn't touch the boxes' positions.
+		static void collidepair( PWorld &_world, PBox *pboxes, const PPair &_pair, PLane &_lane ) {
+			PTRACE_SCOPE_PAIR( "pair", _pair.a, _pair.b );
+			int sides[2] = { _pair.a, _pair.b };
+			PCollision pc;
+			for( int s = 0; s < 2; s++ ) {
+				PBox &box = pboxes[ sides[s] ];
+				if( !box.dynamic ) continue;
+				int other = sides[1 - s];
+				int slot = _world.staticslots[other];
+				if( slot >= 0 )
+					box.collision( pc, pboxes[other], _world.staticgeoms[slot], &_lane.stats );
+				else
+					box.collision( pc, pboxes[other], &_lane.stats );
+				_lane.addcontact( sides[s], other, pc );
+			}
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Impulse solver version of collidepair(). One collision() call
+		// has both boxes' points, so only the dynamic side(a if both are)
+		// is checked.
+		static void collidepaironce( PWorld &_world, PBox *pboxes, const PPair &_pair, PLane &_lane ) {
+			PTRACE_SCOPE_PAIR( "pair", _pair.a, _pair.b );
+			int idx = pboxes[ _pair.a ].dynamic ? _pair.a : _pair.b;
+			int other = ( idx == _pair.a ) ? _pair.b : _pair.a;
+			PBox &box = pboxes[idx];
+			PCollision pc;
+			int slot = _world.staticslots[other];
+			if( slot >= 0 )
+				box.collision( pc, pboxes[other], _world.staticgeoms[slot], &_lane.stats );
+			else
+				box.collision( pc, pboxes[other], &_lane.stats );
+			_lane.addcontact( idx, other, pc );
+		}
+
+		// Pairs and boxes handed to a thread at a time by the step's jobs.
+		static const int PAIRGRAIN = 16;
+		static const int BOXGRAIN = 64;
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// True if one separating axis(PAXIS_) keeps boxes _a and _b clearly
+		// apart. Same checks as rejectbatch(), one pair and one axis at a
+		// time.
+		static bool separated( const PBoxOBB &_a, const PBoxOBB &_b, int _axis ) {
+			vec3 d = _b.center - _a.center;
+			float slop = PCOLLISION_SATSLOP * ( _a.radius + _b.radius );
+			if( _axis == PAXIS_SPHERE ) {
+				float reach = _a.radius + _b.radius;
+				return dot( d, d ) > reach * reach;
+			}
+			if( _axis == PAXIS_WORLD )
+				return fabs( d.x ) > _a.extent.x + _b.extent.x + slop ||
+					   fabs( d.y ) > _a.extent.y + _b.extent.y + slop ||
+					   fabs( d.z ) > _a.extent.z + _b.extent.z + slop;
+			float r[3][3], absr[3][3], t[3];
+			for( int i = 0; i < 3; i++ ) {
+				for( int j = 0; j < 3; j++ ) {
+					r[i][j] = dot( _a.axes[i], _b.axes[j] );
+					absr[i][j] = fabs( r[i][j] ) + 1e-6f;
+				}
+				t[i] = dot( d, _a.axes[i] );
+			}
+			if( _axis < PAXIS_FACEB ) {
+				int i = _axis - PAXIS_FACEA;
+				return fabs( t[i] ) > _a.half[i] + _b.half[0] * absr[i][0] + _b.half[1] * absr[i][1] +
+									  _b.half[2] * absr[i][2] + slop;
+			}
+			if( _axis < PAXIS_EDGE ) {
+				int j = _axis - PAXIS_FACEB;
+				return fabs( t[0] * r[0][j] + t[1] * r[1][j] + t[2] * r[2][j] ) >
+					   _a.half[0] * absr[0][j] + _a.half[1] * absr[1][j] + _a.half[2] * absr[2][j] +
+					   _b.half[j] + slop;
+			}
+			int i = ( _axis - PAXIS_EDGE ) / 3, j = ( _axis - PAXIS_EDGE ) % 3;
+			int i1 = ( i + 1 ) % 3, i2 = ( i + 2 ) % 3, j1 = ( j + 1 ) % 3, j2 = ( j + 2 ) % 3;
+			return fabs( t[i2] * r[i1][j] - t[i1] * r[i2][j] ) >
+				   _a.half[i1] * absr[i2][j] + _a.half[i2] * absr[i1][j] +
+				   _b.half[j1] * absr[i][j2] + _b.half[j2] * absr[i][j1] + slop;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// _axis if it's already set, else _code if _apart. Picks the first axis
+		// that separates a pair without branching.
+		static int firstaxis( int _axis, int _apart, int _code ) {
+			return _axis ? _axis : _apart * _code;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Sphere, world box and separating axis checks for up to
+		// PCOLLISION_BATCH pairs at once. _axes comes in with the axis each
+		// pair was thrown out on last step(PAXIS_NONE if it wasn't), and goes
+		// out with this step's. PAXIS_NONE means the pair goes on to
+		// collision().
+		// Last step's axis is tried first, and if neither box moved(_still) it
+		// separates them again without any checks at all. Boxes usually stay
+		// apart the same way they were.
+		// Every other check is a loop over the pairs doing the same float math,
+		// with no branches, so the compiler can do all of them in one go(8
+		// wide with AVX). The axes checks are skipped when the cheaper ones
+		// already threw out the whole batch.
+		static void rejectbatch( const PBoxOBB *_obbs, const unsigned char *_still, const PPair *_pairs, int _num,
+								 unsigned char *_axes, PLane &_lane ) {
+			const int N = PCOLLISION_BATCH;
+			// Axis each pair is apart on so far, and whether it was last step's.
+			int axis[N], cached[N];
+			int numleft = 0;
+			for( int l = 0; l < N; l++ ) {
+				axis[l] = cached[l] = PAXIS_NONE;
+				if( l >= _num ) continue;
+				const PPair &pair = _pairs[l];
+				int last = _axes[l];
+				if( last != PAXIS_NONE &&
+					( (_still[pair.a] && _still[pair.b]) || separated(_obbs[pair.a], _obbs[pair.b], last) ) )
+					axis[l] = cached[l] = last;
+				else
+					numleft++;
+			}
+
+			if( numleft ) {
+				// Center offset(b - a), in world space, then on a's axes.
+				float d[3][N], t[3][N];
+				// Axes, half sizes and world box half sizes of both boxes.
+				float aa[3][3][N], ab[3][3][N], ha[3][N], hb[3][N], ea[3][N], eb[3][N];
+				// Sum of the spheres, and how much the gap has to be.
+				float reach[N], slop[N];
+				for( int l = 0; l < N; l++ ) {
+					// Short batch, the rest are copies of the first pair.
+					const PPair &pair = _pairs[ ( l < _num ) ? l : 0 ];
+					const PBoxOBB &a = _obbs[pair.a];
+					const PBoxOBB &b = _obbs[pair.b];
+					d[0][l] = b.center.x - a.center.x;
+					d[1][l] = b.center.y - a.center.y;
+					d[2][l] = b.center.z - a.center.z;
+					for( int i = 0; i < 3; i++ ) {
+						aa[i][0][l] = a.axes[i].x; aa[i][1][l] = a.axes[i].y; aa[i][2][l] = a.axes[i].z;
+						ab[i][0][l] = b.axes[i].x; ab[i][1][l] = b.axes[i].y; ab[i][2][l] = b.axes[i].z;
+						ha[i][l] = a.half[i];
+						hb[i][l] = b.half[i];
+					}
+					ea[0][l] = a.extent.x; ea[1][l] = a.extent.y; ea[2][l] = a.extent.z;
+					eb[0][l] = b.extent.x; eb[1][l] = b.extent.y; eb[2][l] = b.extent.z;
+					reach[l] = a.radius + b.radius;
+					slop[l] = PCOLLISION_SATSLOP * reach[l];
+				}
+
+				// 1. Spheres.
+				for( int l = 0; l < N; l++ )
+					axis[l] = firstaxis( axis[l], d[0][l] * d[0][l] + d[1][l] * d[1][l] + d[2][l] * d[2][l] > reach[l] * reach[l],
+										 PAXIS_SPHERE );
+				// 2. World aligned boxes.
+				for( int i = 0; i < 3; i++ )
+					for( int l = 0; l < N; l++ )
+						axis[l] = firstaxis( axis[l], fabs(d[i][l]) > ea[i][l] + eb[i][l] + slop[l], PAXIS_WORLD );
+				numleft = 0;
+				for( int l = 0; l < _num; l++ )
+					numleft += ( axis[l] == PAXIS_NONE );
+
+				// 3. The 15 separating axes. r[i][j] is a's axis i on b's axis j.
+				if( numleft ) {
+					float r[3][3][N], absr[3][3][N];
+					for( int i = 0; i < 3; i++ )
+						for( int j = 0; j < 3; j++ )
+							for( int l = 0; l < N; l++ ) {
+								r[i][j][l] = aa[i][0][l] * ab[j][0][l] + aa[i][1][l] * ab[j][1][l] + aa[i][2][l] * ab[j][2][l];
+								// A little extra, so near parallel edges don't make a
+								// zero axis look like a separating one.
+								absr[i][j][l] = fabs( r[i][j][l] ) + 1e-6f;
+							}
+					for( int i = 0; i < 3; i++ )
+						for( int l = 0; l < N; l++ )
+							t[i][l] = d[0][l] * aa[i][0][l] + d[1][l] * aa[i][1][l] + d[2][l] * aa[i][2][l];
+					// a's faces.
+					for( int i = 0; i < 3; i++ )
+						for( int l = 0; l < N; l++ )
+							axis[l] = firstaxis( axis[l], fabs(t[i][l]) > ha[i][l] + hb[0][l] * absr[i][0][l] +
+																		  hb[1][l] * absr[i][1][l] + hb[2][l] * absr[i][2][l] + slop[l],
+												 PAXIS_FACEA + i );
+					// b's faces.
+					for( int j = 0; j < 3; j++ )
+						for( int l = 0; l < N; l++ )
+							axis[l] = firstaxis( axis[l], fabs(t[0][l] * r[0][j][l] + t[1][l] * r[1][j][l] + t[2][l] * r[2][j][l]) >
+														  ha[0][l] * absr[0][j][l] + ha[1][l] * absr[1][j][l] +
+														  ha[2][l] * absr[2][j][l] + hb[j][l] + slop[l],
+												 PAXIS_FACEB + j );
+					// Edge by edge, a's axis i crossed with b's axis j. The axis
+					// isn't unit length(at most 1), so the gap is only ever
+					// underrated.
+					for( int i = 0; i < 3; i++ ) {
+						int i1 = ( i + 1 ) % 3, i2 = ( i + 2 ) % 3;
+						for( int j = 0; j < 3; j++ ) {
+							int j1 = ( j + 1 ) % 3, j2 = ( j + 2 ) % 3;
+							for( int l = 0; l < N; l++ )
+								axis[l] = firstaxis( axis[l], fabs(t[i2][l] * r[i1][j][l] - t[i1][l] * r[i2][j][l]) >
+															  ha[i1][l] * absr[i2][j][l] + ha[i2][l] * absr[i1][j][l] +
+															  hb[j1][l] * absr[i][j2][l] + hb[j2][l] * absr[i][j1][l] + slop[l],
+													 PAXIS_EDGE + i * 3 + j );
+						}
+					}
+				}
+			}
+
+			for( int l = 0; l < _num; l++ ) {
+				_axes[l] = (unsigned char)axis[l];
+				if( cached[l] )
+					PSTATS_ADD( _lane.stats.axiscachehits, 1 );
+				else if( axis[l] == PAXIS_SPHERE )
+					PSTATS_ADD( _lane.stats.sphereearlyouts, 1 );
+				else if( axis[l] != PAXIS_NONE )
+					PSTATS_ADD( _lane.stats.satearlyouts, 1 );
+			}
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Drops the pairs in pworld.pairs that are clearly apart, keeping the
+		// rest in order. Most pairs in a pile are, and this costs them a few
+		// float ops each instead of a collision() call. Nothing dropped would
+		// have found points(see PCOLLISION_SATSLOP).
+		// The axis each dropped pair was apart on is kept for next step, by
+		// pair id(pworld.sepaxes), along with every box's PBoxOBB, so
+		// rejectbatch() can try it first.
+		static void rejectpairs( PWorld &_world, PBox *pboxes, int _numboxes ) {
+			PTRACE_SCOPE( "reject" );
+			PArenaArray <PBoxOBB> &obbs = _world.obbs;
+			const PArenaArray <PBoxOBB> &lastobbs = _world.lastobbs;
+			obbs.resize( _numboxes );
+			_world.still.resize( _numboxes );
+			_world.jobs.parallelfor( _numboxes, [&]( int _pb, int ) {
+				pboxes[_pb].buildobb( obbs[_pb] );
+				_world.still[_pb] = ( _pb < lastobbs.size() && obbs[_pb].same(lastobbs[_pb]) );
+			}, BOXGRAIN );
+
+			// Last step's axis for every pair. Both lists are sorted by pair id.
+			int numpairs = _world.pairs.size();
+			const PArenaArray <PPairAxis> &lastaxes = _world.lastsepaxes;
+			int numlast = lastaxes.size();
+			_world.pairaxes.resize( numpairs );
+			for( int p = 0, la = 0; p < numpairs; p++ ) {
+				unsigned long long id = _world.pairs[p].id();
+				while( la < numlast && lastaxes[la].id < id )
+					la++;
+				_world.pairaxes[p] = ( la < numlast && lastaxes[la].id == id ) ? lastaxes[la].axis : PAXIS_NONE;
+			}
+
+			int numbatches = ( numpairs + PCOLLISION_BATCH - 1 ) / PCOLLISION_BATCH;
+			_world.jobs.parallelfor( numbatches, [&]( int _b, int _lane ) {
+				int first = _b * PCOLLISION_BATCH;
+				int num = ( numpairs - first < PCOLLISION_BATCH ) ? numpairs - first : PCOLLISION_BATCH;
+				rejectbatch( obbs.begin(), _world.still.begin(), &_world.pairs[first], num,
+							 &_world.pairaxes[first], _world.lanes[_lane] );
+			}, PAIRGRAIN / 2 );
+
+			int numkept = 0;
+			for( int p = 0; p < numpairs; p++ ) {
+				if( _world.pairaxes[p] == PAXIS_NONE ) {
+					_world.pairs[ numkept++ ] = _world.pairs[p];
+					continue;
+				}
+				PPairAxis pa;
+				pa.id = _world.pairs[p].id();
+				pa.axis = _world.pairaxes[p];
+				_world.sepaxes.push_back( pa );
+			}
+			_world.pairs.resize( numkept );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Broadphase and narrowphase for every box pair, for the deterministic
+		// path and the impulse solver. Clearly separated pairs are dropped
+		// first(rejectpairs()), the rest are split up over the threads, each
+		// pair's contacts go in its thread's lane and pworld.pairranges says
+		// where.
+		static void collidepairs( PWorld &_world, PBox *pboxes, int _numboxes, bool _impulse ) {
+			// A missed pair with the impulse solver is a box falling through
+			// another, so look everywhere.
+			gatherpairs( _world, pboxes, _numboxes, _impulse );
+
+			PTRACE_SCOPE( "narrowphase" );
+			PSTATS_BEGIN( coltimer );
+			if( _world.batchreject )
+				rejectpairs( _world, pboxes, _numboxes );
+			int numpairs = _world.pairs.size();
+			_world.pairranges.resize( numpairs );
+			_world.jobs.parallelfor( numpairs, [&]( int _p, int _lane ) {
+				PLane &lane = _world.lanes[_lane];
+				PContactRange &range = _world.pairranges[_p];
+				range.lane = _lane;
+				range.first = lane.contacts.size();
+				if( _impulse )
+					collidepaironce( _world, pboxes, _world.pairs[_p], lane );
+				else
+					collidepair( _world, pboxes, _world.pairs[_p], lane );
+				range.num = lane.contacts.size() - range.first;
+			}, PAIRGRAIN );
+			PSTATS_END( coltimer, _world.lane().stats.narrowphase );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Same, for boxes in pworld.
+		static void collidepairs( PBox *pboxes, int _numboxes, bool _impulse ) {
+			collidepairs( pworld, pboxes, _numboxes, _impulse );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Every dynamic box against the ground, split up over the threads like
+		// collidepairs(). pworld.groundranges has to be _numboxes long already.
+		static void collidegrounds( PWorld &_world, PBox *pboxes, int _numboxes ) {
+			PTRACE_SCOPE( "ground" );
+			PSTATS_BEGIN( coltimer );
+			_world.jobs.parallelfor( _numboxes, [&]( int _pb, int _lane ) {
+				PLane &lane = _world.lanes[_lane];
+				PContactRange &range = _world.groundranges[_pb];
+				range.lane = _lane;
+				range.first = lane.contacts.size();
+				if( pboxes[_pb].dynamic )
+					storeground( _world, pboxes, _pb, lane );
+				range.num = lane.contacts.size() - range.first;
+			}, BOXGRAIN );
+			PSTATS_END( coltimer, _world.lane().stats.narrowphase );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Turns every contact record into a PSolverContact with one point per
+		// contact point, and works out the masses. Impulses start at last
+		// step's, for points that were there last step, else 0.
+		static void buildcontacts( PWorld &_world, PBox *pboxes ) {
+			int numcontacts = _world.contacts.size();
+			for( int c = 0; c < numcontacts; c++ ) {
+				PPairContact &ppc = _world.contacts[c];
+				const PCPoint *pnts = &_world.contactpoints[ ppc.firstpoint ];
+				PBox &boxa = pboxes[ ppc.box ];
+				PBox *boxb = ( ppc.other >= 0 ) ? &pboxes[ ppc.other ] : 0;
+
+				PSolverContact sc;
+				sc.a = ppc.box;
+				sc.b = ( ppc.other >= 0 ) ? ppc.other : -1;
+				sc.id = PWorld::contactid( ppc.box, ppc.other );
+				PSolverContact *last = _world.warmstart ? _world.findlastcontact( sc.id ) : 0;
+				// Same pair from the other side(two dynamic boxes renamed past
+				// each other), its normal and impulses point the wrong way.
+				if( last && last->a != sc.a )
+					last = 0;
+				if( boxb )
+					sc.depth = boxa.facenormal( *boxb, sc.normal );
+				else {
+					PCollision pc;
+					_world.getcontact( c, pc );
+					sc.normal = boxa.contactnormal( pc );
+					sc.depth = boxa.grounddepth( _world, -1 - ppc.other, sc.normal );
+				}
+				// Any two directions perpendicular to the normal.
+				vec3 helper = ( fabs(sc.normal.x) > 0.57f ) ? vec3( 0, 1, 0 ) : vec3( 1, 0, 0 );
+				sc.tangents[0] = normalize( cross(sc.normal, helper) );
+				sc.tangents[1] = cross( sc.normal, sc.tangents[0] );
+				sc.friction = _world.friction;
+				sc.bias = _world.baumgarte * ( sc.depth - _world.slop );
+				sc.bias = ( sc.bias > 0 ) ? sc.bias : 0.0f;
+				sc.bias = ( sc.bias < _world.maxcorrection ) ? sc.bias : _world.maxcorrection;
+				sc.firstpoint = _world.solverpoints.size();
+				sc.color = 0;
+
+				float invma = boxa.invmass;
+				float invmb = ( boxb && boxb->dynamic ) ? boxb->invmass : 0.0f;
+				for( int p = 0; p < ppc.numpoints; p++ ) {
+					// The same corner is often found by a couple of lines/faces.
+					// Copies would get more than their share of the first
+					// iterations' impulse and twist the boxes.
+					bool copy = false;
+					for( int p2 = 0; p2 < p && !copy; p2++ ) {
+						vec3 d = pnts[p].pnt - pnts[p2].pnt;
+						copy = dot( d, d ) < 0.0001f;
+					}
+					if( copy ) continue;
+					PSolverPoint sp;
+					sp.ra = pnts[p].pnt - boxa.pos;
+					sp.rb = boxb ? pnts[p].pnt - boxb->pos : vec3( 0, 0, 0 );
+					sp.local = boxa.tolocal( sp.ra );
+					// 1 / (ma^-1 + mb^-1 + angular terms) for each direction.
+					const vec3 *dirs[3] = { &sc.normal, &sc.tangents[0], &sc.tangents[1] };
+					float masses[3];
+					for( int d = 0; d < 3; d++ ) {
+						const vec3 &dir = *dirs[d];
+						float k = invma + invmb + dot( dir, cross(boxa.invinertiamul(cross(sp.ra, dir)), sp.ra) );
+						if( boxb )
+							k += dot( dir, cross(boxb->invinertiamul(cross(sp.rb, dir)), sp.rb) );
+						masses[d] = ( k > 0 ) ? 1.0f / k : 0.0f;
+					}
+					sp.normalmass = masses[0];
+					sp.tangentmass[0] = masses[1];
+					sp.tangentmass[1] = masses[2];
+					sp.normalimpulse = 0.0f;
+					sp.tangentimpulse[0] = sp.tangentimpulse[1] = 0.0f;
+					sp.splitimpulse = 0.0f;
+					// Same spot on box a as one of last step's points? Start
+					// with its impulses.
+					if( last ) {
+						float closest = 0.0025f;
+						for( int lp = last->firstpoint; lp < last->firstpoint + last->numpoints; lp++ ) {
+							const PSolverPoint &lsp = _world.lastpoints[lp];
+							vec3 d = lsp.local - sp.local;
+							if( dot(d, d) < closest ) {
+								closest = dot( d, d );
+								sp.normalimpulse = lsp.normalimpulse;
+								sp.tangentimpulse[0] = lsp.tangentimpulse[0];
+								sp.tangentimpulse[1] = lsp.tangentimpulse[1];
+							}
+						}
+					}
+					_world.solverpoints.push_back( sp );
+				}
+				sc.numpoints = _world.solverpoints.size() - sc.firstpoint;
+				_world.solvercontacts.push_back( sc );
+			}
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Velocity of a point _r away from the center of a box moving at
+		// _vel and spinning at _angvel.
+		static vec3 pointvel( const vec3 &_vel, const vec3 &_angvel, const vec3 &_r ) {
+			return _vel + cross( _angvel, _r );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Pushes box _idx with impulse _imp at _r from its center. Changes
+		// _vel/_angvel, which are either the box's own or its split impulse
+		// velocities. Ground(-1) and static boxes don't budge.
+		static void applyimpulse( PBox *pboxes, int _idx, vec3 &_vel, vec3 &_angvel, const vec3 &_r, const vec3 &_imp ) {
+			if( _idx < 0 || !pboxes[_idx].dynamic ) return;
+			_vel = _vel + _imp * pboxes[_idx].invmass;
+			_angvel = _angvel + pboxes[_idx].invinertiamul( cross(_r, _imp) );
+		}
+
+		// Most color batches. One bit each in a box's color mask.
+		static const int MAXCOLORS = 64;
+		// Contacts handed to a thread at a time in a color batch.
+		static const int CONTACTGRAIN = 16;
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Sorts the solver contacts into color batches. No two contacts in a
+		// batch share a dynamic box, so a whole batch can be solved at once on
+		// every thread without two of them pushing the same box. Greedy, in
+		// contact order: each contact gets the first color neither of its
+		// boxes has yet. Contacts left over once a box has all MAXCOLORS go in
+		// one last batch, solved on one thread.
+		// Same contacts in, same batches out.
+		static void colorcontacts( PWorld &_world, PBox *pboxes, int _numboxes ) {
+			int numcontacts = _world.solvercontacts.size();
+			PArenaArray <unsigned long long> &masks = _world.colormasks;
+			PArenaArray <int> &starts = _world.batchstarts;
+			masks.assign( _numboxes, 0 );
+			starts.assign( MAXCOLORS + 2, 0 );
+			for( int c = 0; c < numcontacts; c++ ) {
+				PSolverContact &sc = _world.solvercontacts[c];
+				// Ground and static boxes don't move, any number of batches
+				// can share them.
+				bool movingb = ( sc.b >= 0 && pboxes[ sc.b ].dynamic );
+				unsigned long long used = masks[ sc.a ] | ( movingb ? masks[ sc.b ] : 0 );
+				int color = 0;
+				while( color < MAXCOLORS && ( used >> color ) & 1 )
+					color++;
+				if( color < MAXCOLORS ) {
+					masks[ sc.a ] |= 1ULL << color;
+					if( movingb )
+						masks[ sc.b ] |= 1ULL << color;
+				}
+				sc.color = color;
+				starts[ color + 1 ]++;
+			}
+			for( int b = 0; b <= MAXCOLORS; b++ )
+				starts[b + 1] += starts[b];
+			// Contacts in batch order, contact order within each.
+			_world.batchorder.resize( numcontacts );
+			for( int c = 0; c < numcontacts; c++ )
+				_world.batchorder[ starts[ _world.solvercontacts[c].color ]++ ] = c;
+			// Filling moved every start up to the next batch's, put them back.
+			for( int b = MAXCOLORS + 1; b > 0; b-- )
+				starts[b] = starts[b - 1];
+			starts[0] = 0;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Calls _fn( c ) for every solver contact. In contact order, or with
+		// pworld.colorbatches one color batch after the other, each spread
+		// over the threads.
+		template <class F>
+		static void forcontacts( PWorld &_world, const F &_fn ) {
+			int numcontacts = _world.solvercontacts.size();
+			if( !_world.colorbatches ) {
+				for( int c = 0; c < numcontacts; c++ )
+					_fn( c );
+				return;
+			}
+			const PArenaArray <int> &order = _world.batchorder;
+			const PArenaArray <int> &starts = _world.batchstarts;
+			for( int b = 0; b < MAXCOLORS; b++ ) {
+				int first = starts[b];
+				_world.jobs.parallelfor( starts[b + 1] - first, [&]( int _i, int ) {
+					_fn( order[ first + _i ] );
+				}, CONTACTGRAIN );
+			}
+			// Leftovers, one at a time.
+			for( int i = starts[MAXCOLORS]; i < numcontacts; i++ )
+				_fn( order[i] );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Sequential impulses. Every iteration goes over every point in contact
+		// order and applies just enough impulse to stop the boxes moving into
+		// each other(plus bias with Baumgarte), and friction within
+		// friction * normal impulse. Impulses are summed per point and clamped
+		// as a sum, so later iterations can take back what earlier ones
+		// overdid.
+		// With pworld.colorbatches, each pass goes batch by batch instead(see
+		// colorcontacts()).
+		static void solvecontacts( PWorld &_world, PBox *pboxes ) {
+			vec3 zero( 0, 0, 0 );
+			bool baumgarte = ( _world.correction == PCORRECT_BAUMGARTE );
+
+			// Warm start. Whatever buildcontacts() carried over gets applied
+			// before the first iteration.
+			forcontacts( _world, [&]( int c ) {
+				PSolverContact &sc = _world.solvercontacts[c];
+				PBox &boxa = pboxes[ sc.a ];
+				vec3 groundvel = zero;
+				vec3 groundangvel = zero;
+				bool movingb = ( sc.b >= 0 && pboxes[ sc.b ].dynamic );
+				vec3 &velb = movingb ? pboxes[ sc.b ].vel : groundvel;
+				vec3 &angvelb = movingb ? pboxes[ sc.b ].angvel : groundangvel;
+				for( int p = sc.firstpoint; p < sc.firstpoint + sc.numpoints; p++ ) {
+					PSolverPoint &sp = _world.solverpoints[p];
+					vec3 imp = sc.normal * sp.normalimpulse +
+							   sc.tangents[0] * sp.tangentimpulse[0] +
+							   sc.tangents[1] * sp.tangentimpulse[1];
+					applyimpulse( pboxes, sc.a, boxa.vel, boxa.angvel, sp.ra, imp );
+					applyimpulse( pboxes, sc.b, velb, angvelb, sp.rb, imp * -1 );
+				}
+			} );
+
+			for( int it = 0; it < _world.iterations; it++ ) {
+				forcontacts( _world, [&]( int c ) {
+					PSolverContact &sc = _world.solvercontacts[c];
+					PBox &boxa = pboxes[ sc.a ];
+					// Ground and static boxes don't move, give them some zeros to
+					// work with.
+					bool movingb = ( sc.b >= 0 && pboxes[ sc.b ].dynamic );
+					vec3 groundvel = zero;
+					vec3 groundangvel = zero;
+					vec3 &velb = movingb ? pboxes[ sc.b ].vel : groundvel;
+					vec3 &angvelb = movingb ? pboxes[ sc.b ].angvel : groundangvel;
+					for( int p = sc.firstpoint; p < sc.firstpoint + sc.numpoints; p++ ) {
+						PSolverPoint &sp = _world.solverpoints[p];
+
+						// Friction first, limited by last iteration's normal impulse.
+						float maxfriction = sc.friction * sp.normalimpulse;
+						for( int t = 0; t < 2; t++ ) {
+							vec3 dv = pointvel( boxa.vel, boxa.angvel, sp.ra ) - pointvel( velb, angvelb, sp.rb );
+							float lambda = -dot( dv, sc.tangents[t] ) * sp.tangentmass[t];
+							float old = sp.tangentimpulse[t];
+							float total = old + lambda;
+							total = ( total > maxfriction ) ? maxfriction : total;
+							total = ( total < -maxfriction ) ? -maxfriction : total;
+							sp.tangentimpulse[t] = total;
+							vec3 imp = sc.tangents[t] * ( total - old );
+							applyimpulse( pboxes, sc.a, boxa.vel, boxa.angvel, sp.ra, imp );
+							applyimpulse( pboxes, sc.b, velb, angvelb, sp.rb, imp * -1 );
+						}
+
+						// Normal. Never pull the boxes together.
+						vec3 dv = pointvel( boxa.vel, boxa.angvel, sp.ra ) - pointvel( velb, angvelb, sp.rb );
+						float target = baumgarte ? sc.bias : 0.0f;
+						float lambda = ( target - dot(dv, sc.normal) ) * sp.normalmass;
+						float old = sp.normalimpulse;
+						float total = ( old + lambda > 0 ) ? old + lambda : 0.0f;
+						sp.normalimpulse = total;
+						vec3 imp = sc.normal * ( total - old );
+						applyimpulse( pboxes, sc.a, boxa.vel, boxa.angvel, sp.ra, imp );
+						applyimpulse( pboxes, sc.b, velb, angvelb, sp.rb, imp * -1 );
+					}
+				} );
+			}
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Split impulse position pass. Same as solvecontacts()' normal part,
+		// but on pworld.splitvel/splitangvel, which only move boxes for this
+		// step. Penetration gets fixed without leaving any velocity behind.
+		static void solvesplit( PWorld &_world, PBox *pboxes, int _numboxes ) {
+			vec3 zero( 0, 0, 0 );
+			_world.splitvel.assign( _numboxes, zero );
+			_world.splitangvel.assign( _numboxes, zero );
+			for( int it = 0; it < _world.iterations; it++ ) {
+				forcontacts( _world, [&]( int c ) {
+					PSolverContact &sc = _world.solvercontacts[c];
+					if( sc.bias <= 0 ) return;
+					vec3 groundvel = zero;
+					vec3 groundangvel = zero;
+					vec3 &vela = _world.splitvel[ sc.a ];
+					vec3 &angvela = _world.splitangvel[ sc.a ];
+					vec3 &velb = ( sc.b >= 0 ) ? _world.splitvel[ sc.b ] : groundvel;
+					vec3 &angvelb = ( sc.b >= 0 ) ? _world.splitangvel[ sc.b ] : groundangvel;
+					for( int p = sc.firstpoint; p < sc.firstpoint + sc.numpoints; p++ ) {
+						PSolverPoint &sp = _world.solverpoints[p];
+						vec3 dv = pointvel( vela, angvela, sp.ra ) - pointvel( velb, angvelb, sp.rb );
+						float lambda = ( sc.bias - dot(dv, sc.normal) ) * sp.normalmass;
+						float old = sp.splitimpulse;
+						float total = ( old + lambda > 0 ) ? old + lambda : 0.0f;
+						sp.splitimpulse = total;
+						vec3 imp = sc.normal * ( total - old );
+						applyimpulse( pboxes, sc.a, vela, angvela, sp.ra, imp );
+						applyimpulse( pboxes, sc.b, velb, angvelb, sp.rb, imp * -1 );
+					}
+				} );
+			}
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Impulse solver half of update(). Velocities must already have accel
+		// added.
+		// 1. Gather and sort pairs like deterministic mode, from every node.
+		// 2. collision() once per pair, plus the ground, against untouched
+		//    box state.
+		// 3. Solve every contact together with sequential impulses.
+		// 4. Move and spin the boxes by what's left of their velocities(plus
+		//    the split impulse velocities).
+		// 1 and 2 run as jobs(collidepairs() and collidegrounds()), this does
+		// 3 and 4.
+		static void updateimpulse( PWorld &_world, PBox *pboxes, int _numboxes ) {
+			_world.takecontacts();
+
+			// Velocities.
+			{
+				PTRACE_SCOPE( "solve" );
+				PSTATS_BEGIN( reacttimer );
+				buildcontacts( _world, pboxes );
+				if( _world.colorbatches )
+					colorcontacts( _world, pboxes, _numboxes );
+				solvecontacts( _world, pboxes );
+				PSTATS_END( reacttimer, _world.stats.reaction );
+			}
+
+			// Positions.
+			PTRACE_SCOPE( "correct" );
+			PSTATS_BEGIN( pentimer );
+			bool split = ( _world.correction == PCORRECT_SPLIT );
+			if( split )
+				solvesplit( _world, pboxes, _numboxes );
+			for( int pb = 0; pb < _numboxes; pb++ ) {
+				PBox &box = pboxes[pb];
+				if( !box.dynamic ) continue;
+				if( split ) {
+					box.pos = box.pos + _world.splitvel[pb];
+					box.applyangvel( box.angvel + _world.splitangvel[pb] );
+				}
+				else
+					box.applyangvel( box.angvel );
+				box.setpos( box.pos + box.vel );
+			}
+			// Keep pc pointing at the last contact like the other paths.
+			int numcontacts = _world.contacts.size();
+			for( int c = 0; c < numcontacts; c++ )
+				_world.getcontact( c, pboxes[ _world.contacts[c].box ].pc );
+			PSTATS_END( pentimer, _world.stats.penetration );
+		}
+
+		/////////////////////////////////////////////////////////////////////////////
+		//
+		// Hashes every box's transform and velocity(FNV-1a over the raw bits).
+		// Two runs in deterministic mode with the same inputs give the same
+		// hash. Handy for lockstep checks and caching results by input.
+		static unsigned long long statehash( const PBox *pboxes, int _numboxes ) {
+			unsigned long long hash = 14695981039346656037ULL;
+			for( int pb = 0; pb < _numboxes; pb++ ) {
+				const PBox &box = pboxes[pb];
+				const float vals[14] = { box.pos.x, box.pos.y, box.pos.z,
+										 box.vel.x, box.vel.y, box.vel.z,
+										 box.angvel.x, box.angvel.y, box.angvel.z,
+										 box.raxis.x, box.raxis.y, box.raxis.z,
+										 box.rangle, box.dynamic ? 1.0f : 0.0f };
+				const unsigned char *bytes = (const unsigned char *)vals;
+				for( unsigned int b = 0; b < sizeof(vals); b++ ) {
+					hash ^= bytes[b];
+					hash *= 1099511628211ULL;
+				}
+			}
+			return hash;
+		}
+
 		/////////////////////////////////////////////////////////////////////////////
 		//
 		// Updates all box's velocities, positions, etc.
@@ -738,34 +2156,139 @@ class PBox {
 		// PBox box( vec3(0, 0, 0) );
 		// PBox::update( &box, 1 );
 		//
-		static void update( PBox *pboxes, int _numboxes ) {
+		// Set pworld.deterministic = true before calling for bit-reproducible
+		// steps. See updatepairs().
+		//
+		// Set pworld.solver = PSOLVER_IMPULSE for the impulse solver. See
+		// updateimpulse() and PSolver.h.
+		// _world is pworld unless you made one of your own(see PWorlds.h).
+		//
+		static void update( PWorld &_world, PBox *pboxes, int _numboxes ) {
+
+			PTRACE_SCOPE( "step" );
+
+			// Step stats start from scratch every update().
+			PSTATS_BEGIN( steptimer );
+			PSTATS_SET( _world.stats, PStepStats() );
+			PSTATS_SET( _world.tree.nodesvisited, 0 );
+			PSTATS_SET( _world.statictree.nodesvisited, 0 );
+			unsigned long long allocs = pheapallocs;
+
+			// Fresh frame arena, last step's constraints kept for warm
+			// starting.
+			_world.nextstep();
+			_world.numboxes = _numboxes;
+
+			// The step's phases run as jobs(see PJobs.h), each after the ones
+			// it reads from. Anything that doesn't wait on another can run
+			// alongside it.
+			// The impulse solver moves boxes after it's fixed their velocities.
+			bool impulse = ( _world.solver == PSOLVER_IMPULSE );
+			bool gather = impulse || _world.deterministic;
+			PJobs &jobs = _world.jobs;
 
 			// Update every box's vel/pos/etc.
-			for( int pb = 0; pb < _numboxes; pb++ ) {
-				// Update velocity.
-				pboxes[pb].vel = pboxes[pb].vel + pboxes[pb].accel;
-				// Update position.
-				pboxes[pb].setpos( pboxes[pb].pos + pboxes[pb].vel );
-				// Add this box/sphere to the octree.
-				if( sptree.numnodes == 0 )
-                    sptree.addsphere( pboxes[pb].pos, pboxes[pb].largestaxis );
-                else
-                    sptree.refreshsphere( pb, pboxes[pb].pos );
-			}
-
-			// Build octree.
-            if( sptree.numnodes == 0 ) {
-                sptree.buildtree( 5, vec3(150, 150, 150), vec3(10.0f, 0.0f, 10.0f) );
-            }
-
-			// Grab every box, look in its octree bucket and do
+			// Static boxes don't move, skip them.
+			auto integrate = [&]( int, int ) {
+				PTRACE_SCOPE( "integrate" );
+				PSTATS_BEGIN( inttimer );
+				jobs.parallelfor( _numboxes, [&]( int _pb, int ) {
+					if( !pboxes[_pb].dynamic ) return;
+					// Update velocity.
+					pboxes[_pb].vel = pboxes[_pb].vel + pboxes[_pb].accel;
+					// Update position.
+					if( !impulse )
+						pboxes[_pb].setpos( pboxes[_pb].pos + pboxes[_pb].vel );
+				}, BOXGRAIN );
+				PSTATS_END( inttimer, _world.stats.integrate );
+			};
+
+			// Put every dynamic box/sphere in its octree bucket.
+			auto tree = [&]( int, int ) {
+				PTRACE_SCOPE( "tree" );
+				PSTATS_BEGIN( treetimer );
+
+				// Build octree. Every box gets a sphere so sphere indices
+				// match box indices, but only dynamic boxes are placed.
+				// Static boxes go into their own tree.
+				_world.tree.jobs = &_world.jobs;
+				if( _world.tree.numnodes == 0 ) {
+					for( int pb = 0; pb < _numboxes; pb++ )
+						_world.tree.addsphere( pboxes[pb].pos, pboxes[pb].largestaxis, pboxes[pb].category );
+					_world.tree.buildtree( 5, vec3(150, 150, 150), vec3(10.0f, 0.0f, 10.0f), false );
+					buildstatics( _world, pboxes, _numboxes );
+				}
+				// Boxes added or dropped since.
+				else if( (int)_world.tree.slist.size() != _numboxes )
+					syncboxes( _world, pboxes, _numboxes );
+
+				// All at once, sorted, instead of one refreshsphere() each.
+				// Nodes only need their layers if some box's mask leaves
+				// something out.
+				unsigned int masks = 0xFFFFFFFF;
+				for( int pb = 0; pb < _numboxes; pb++ ) {
+					if( pboxes[pb].dynamic ) {
+						_world.tree.movesphere( pb, pboxes[pb].pos );
+						_world.tree.setlayers( pb, pboxes[pb].category );
+						masks &= pboxes[pb].mask;
+						_world.movers.push_back( pb );
+					}
+				}
+				_world.tree.layered = ( masks != 0xFFFFFFFF );
+				_world.tree.placespheres( _world.movers.begin(), _world.movers.size() );
+				PSTATS_END( treetimer, _world.stats.treerefresh );
+			};
+
+			// Pairs from the tree, and their contacts.
+			auto pairs = [&]( int, int ) { collidepairs( _world, pboxes, _numboxes, impulse ); };
+			// Ground contacts only need the boxes where they are.
+			auto ground = [&]( int, int ) { collidegrounds( _world, pboxes, _numboxes ); };
+
+			int intjob = jobs.add( 1, integrate );
+			int treejob = jobs.add( 1, tree );
+			// Without the impulse solver the boxes move while integrating.
+			if( !impulse )
+				jobs.after( treejob, intjob );
+			// The impulse solver and deterministic mode gather and sort pairs
+			// and find every contact before reacting to anything.
+			if( gather ) {
+				_world.groundranges.resize( _numboxes );
+				jobs.after( jobs.add(1, pairs), treejob );
+				int groundjob = jobs.add( 1, ground );
+				if( !impulse )
+					jobs.after( groundjob, intjob );
+			}
+			jobs.run();
+
+			// Impulse solver, always gathers and sorts pairs first.
+			if( impulse ) {
+				updateimpulse( _world, pboxes, _numboxes );
+				endstep( _world, allocs );
+				PSTATS_END( steptimer, _world.stats.total );
+				return;
+			}
+
+			// Deterministic mode, responses in pair order.
+			if( _world.deterministic ) {
+				updatepairs( _world, pboxes, _numboxes );
+				endstep( _world, allocs );
+				PSTATS_END( steptimer, _world.stats.total );
+				return;
+			}
+
+			// Grab every dynamic box, look in its octree bucket and do
 			// collisions.
+			PTRACE_SCOPE( "collide" );
 			for( int pb = 0; pb < _numboxes; pb++ ) {
+				if( !pboxes[pb].dynamic ) continue;
                 // Grab bucket this box could be in.
-                Spocket *bucket = sptree.getbucket( pb );
-                int bucketid = bucket->id;
-                // The number if box indices this bucket has.
-				int numsidx = bucket->numsindices;
+				PSTATS_BEGIN( buckettimer );
+                Spocket *bucket = _world.tree.getbucket( pb );
+				PSTATS_END( buckettimer, _world.stats.getbucket );
+                // The number if box indices this bucket has. No bucket if the
+                // box is somewhere the tree couldn't grow to(NaN, say), and
+                // none worth checking if it has nothing in our layers.
+				int numsidx = ( bucket && (_world.tree.nodelayers(bucket) & pboxes[pb].mask) ) ? bucket->numsindices : 0;
 
                 // Do collision check between this box and the bucket
 				for( int cidx = 0; cidx < numsidx; cidx++ ) {
@@ -774,24 +2297,33 @@ class PBox {
                     // If this index is the current box, don't check
                     // against itself.
 					if( pb == idx2 ) continue;
+					// Or if their layers say they don't collide.
+					if( !pboxes[pb].canhit(pboxes[idx2]) ) {
+						PSTATS_ADD( _world.stats.layerskips, 1 );
+						continue;
+					}
 
 					// Finally do collision check.
-					pboxes[pb].collision( pboxes[pb].pc, pboxes[idx2] );
+					PTRACE_SCOPE_PAIR( "pair", pb, idx2 );
+					PSTATS_BEGIN( coltimer );
+					pboxes[pb].collision( pboxes[pb].pc, pboxes[idx2], &_world.lane().stats );
+					PSTATS_END( coltimer, _world.stats.narrowphase );
 
 					// React to the collision.
 					if( pboxes[pb].pc.numcolpnts > 0 ) {
+						touch( _world, pb, idx2, pboxes[pb].pc );
 						// Fix penetration and react for box 1.
-						if( pboxes[pb].dynamic ) {
-							pboxes[pb].fixpenetration( pboxes[pb].pc );
-							pboxes[pb].reaction( pboxes[pb].pc );
-						}
+						if( pboxes[pb].dynamic )
+							pboxes[pb].respond( pboxes[pb].pc, &_world.lane().stats );
 						// Grab collision info for second box.
 						// Check for bumps, fix penetration, and react.
 						if( pboxes[idx2].dynamic ) {
-							pboxes[idx2].collision( pboxes[idx2].pc, pboxes[pb] );
+							PSTATS_BEGIN( col2timer );
+							pboxes[idx2].collision( pboxes[idx2].pc, pboxes[pb], &_world.lane().stats );
+							PSTATS_END( col2timer, _world.stats.narrowphase );
 							if( pboxes[idx2].pc.numcolpnts > 0 ) {
-								pboxes[idx2].fixpenetration( pboxes[idx2].pc );
-								pboxes[idx2].reaction( pboxes[idx2].pc );
+								touch( _world, idx2, pb, pboxes[idx2].pc );
+								pboxes[idx2].respond( pboxes[idx2].pc, &_world.lane().stats );
 							}
 						}
 
@@ -799,9 +2331,22 @@ class PBox {
 
 				} // for( int cidx...
 
+				// Static boxes, then the ground.
+				collidestatics( _world, pboxes, pb );
+				collideground( _world, pboxes, pb );
+
 			} // for( int pb...
 
-            sptree.reset();
+			endstep( _world, allocs );
+			PSTATS_END( steptimer, _world.stats.total );
 
 		} // update()
+
+		/////////////////////////////////////////////////////////////////////////////
+		// Steps boxes in pworld, the usual world.
+		static void update( PBox *pboxes, int _numboxes ) {
+			update( pworld, pboxes, _numboxes );
+		}
 };
+
+#endif // PBOX_H
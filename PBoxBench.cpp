@@ -0,0 +1,494 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PBoxBench - Microbenchmarks for the PBox hot paths.
+//
+// Times the collision and octree primitives one at a time so changes to
+// them can be compared run to run...
+// * lineintri(), pointintri(), lineinface().
+// * collision() for separated, touching and deeply penetrating pairs.
+// * multaa(), transformpoints().
+// * SpocTree::buildtree(), getbucket(), refreshsphere(), placespheres(),
+//   full and sparse.
+// * Whole update() steps with the impulse solver, a pile in one corner and
+//   boxes scattered everywhere else. Then just collidepairs() on that
+//   scene, with and without pworld.batchreject and the separating axis
+//   cache. Then steps with most boxes in a debris layer that skips itself.
+// * Steps with boxes spawned and removed every step, through PBodies and
+//   by rebuilding the world the old way.
+// * The pile and scatter again, added in random order, stepped as added
+//   and then after PBodies::sort().
+// * A thousand 50 box worlds stepped as a PWorlds batch, against the same
+//   scene alone in pworld. Calls are world steps.
+//
+// Inputs are random but seeded, so every run tests the same data.
+// Prints nanoseconds and calls per second for each.
+//
+// Usage:
+// PBoxBench [seed] [scale] [threads] [pin]
+// scale multiplies the number of calls, 1 by default. threads is how many
+// the octree and step benchmarks run on, 1 by default. pin 1 pins the
+// worker threads to cores.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+// Timing.
+#include <chrono>
+
+// Physics Box, and boxes that come and go.
+#include "PBodies.h"
+// Lots of small worlds.
+#include "PWorlds.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Small seeded generator(xorshift32). Same seed, same numbers, any platform.
+struct BenchRand {
+	unsigned int state;
+	BenchRand( unsigned int _seed ): state( _seed ? _seed : 1 ) {}
+	unsigned int next( void ) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+	// Float in [_lo, _hi].
+	float range( float _lo, float _hi ) {
+		return _lo + ( _hi - _lo ) * ( next() & 0xFFFFFF ) / (float)0xFFFFFF;
+	}
+	vec3 vec( float _lo, float _hi ) {
+		return vec3( range(_lo, _hi), range(_lo, _hi), range(_lo, _hi) );
+	}
+	// Random unit axis.
+	vec3 axis( void ) {
+		vec3 ax = vec( -1, 1 );
+		return magnitude( ax ) > 0.001f ? normalize( ax ) : vec3( 0, 1, 0 );
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Keeps the compiler from throwing away results.
+volatile float benchsink = 0.0f;
+
+// Number of inputs generated per benchmark. Calls cycle through them.
+const int NUMINPUTS = 1024;
+
+///////////////////////////////////////////////////////////////////////////////
+// Prints one result line.
+void report( const char *_name, long long _calls, double _secs ) {
+	double nspercall = ( _secs * 1e9 ) / _calls;
+	printf( "%-28s %12lld calls %10.1f ns/call %14.0f calls/s\n",
+			_name, _calls, nspercall, _calls / _secs );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs _func(i) _calls times and reports.
+template <class F>
+void bench( const char *_name, long long _calls, F _func ) {
+	// Warm up caches and branch predictors.
+	for( int w = 0; w < NUMINPUTS; w++ )
+		_func( w );
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for( long long c = 0; c < _calls; c++ )
+		_func( (int)(c & (NUMINPUTS - 1)) );
+	double secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+	report( _name, _calls, secs );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Random box near the origin with a random orientation.
+PBox randombox( BenchRand &_rnd, const vec3 &_pos ) {
+	return PBox( _pos, vec3(1, 1, 1), vec3(1, 1, 1), _rnd.axis(), _rnd.range(0, 360) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main( int argc, char **argv ) {
+	unsigned int seed = ( argc > 1 ) ? (unsigned int)atoi( argv[1] ) : 12345;
+	long long scale = ( argc > 2 ) ? atoi( argv[2] ) : 1;
+	if( scale < 1 ) scale = 1;
+	pworld.jobs.setthreads( ( argc > 3 ) ? atoi( argv[3] ) : 1, ( argc > 4 ) && atoi( argv[4] ) );
+	BenchRand rnd( seed );
+
+	printf( "PBoxBench seed %u scale %lld threads %d\n", seed, scale, pworld.jobs.threads() );
+
+	// Scratch box for member primitives.
+	PBox box;
+
+	///////////////////////////
+	// Line/triangle primitives.
+	{
+		static vec3 lines[NUMINPUTS][2];
+		static vec3 tris[NUMINPUTS][3];
+		static vec3 faces[NUMINPUTS][4];
+		static vec3 pnts[NUMINPUTS];
+		for( int i = 0; i < NUMINPUTS; i++ ) {
+			// Triangle/face in the XZ plane with some jitter, line through y.
+			vec3 c = rnd.vec( -1, 1 );
+			faces[i][0] = c + vec3( -0.5f, rnd.range(-0.1f, 0.1f), -0.5f );
+			faces[i][1] = c + vec3( -0.5f, rnd.range(-0.1f, 0.1f),  0.5f );
+			faces[i][2] = c + vec3(  0.5f, rnd.range(-0.1f, 0.1f),  0.5f );
+			faces[i][3] = c + vec3(  0.5f, rnd.range(-0.1f, 0.1f), -0.5f );
+			for( int t = 0; t < 3; t++ )
+				tris[i][t] = faces[i][t];
+			vec3 hit = c + vec3( rnd.range(-0.7f, 0.7f), 0, rnd.range(-0.7f, 0.7f) );
+			lines[i][0] = hit + vec3( 0, rnd.range(0.1f, 1.0f), 0 );
+			lines[i][1] = hit - vec3( 0, rnd.range(-0.2f, 1.0f), 0 );
+			pnts[i] = hit;
+		}
+		bench( "lineintri", 2000000 * scale, [&]( int i ) {
+			benchsink += box.lineintri( lines[i], tris[i] ).x;
+		} );
+		bench( "pointintri", 4000000 * scale, [&]( int i ) {
+			benchsink += box.pointintri( pnts[i], tris[i] ) ? 1.0f : 0.0f;
+		} );
+		bench( "lineinface", 2000000 * scale, [&]( int i ) {
+			benchsink += box.lineinface( lines[i], faces[i] ).x;
+		} );
+	}
+
+	///////////////////////////
+	// collision().
+	{
+		static PBox boxes1[NUMINPUTS];
+		static PBox boxes2[NUMINPUTS];
+		static PCollision pc;
+		// Separated: far apart, fails the sphere check.
+		// Touching: centers about a box width apart.
+		// Penetrating: centers almost on top of each other.
+		const char *names[3] = { "collision separated", "collision touching", "collision penetrating" };
+		const float mindist[3] = { 5.0f, 0.95f, 0.0f };
+		const float maxdist[3] = { 10.0f, 1.1f, 0.3f };
+		const long long calls[3] = { 20000000, 100000, 100000 };
+		for( int k = 0; k < 3; k++ ) {
+			for( int i = 0; i < NUMINPUTS; i++ ) {
+				boxes1[i] = randombox( rnd, vec3(0, 0, 0) );
+				boxes2[i] = randombox( rnd, rnd.axis() * rnd.range(mindist[k], maxdist[k]) );
+			}
+			bench( names[k], calls[k] * scale, [&]( int i ) {
+				boxes1[i].collision( pc, boxes2[i] );
+				benchsink += pc.numcolpnts;
+			} );
+		}
+	}
+
+	///////////////////////////
+	// multaa() and transformpoints().
+	{
+		static vec3 aa1[NUMINPUTS];
+		static vec3 aa2[NUMINPUTS];
+		static mat4 mats[NUMINPUTS];
+		static vec3 dest[8];
+		for( int i = 0; i < NUMINPUTS; i++ ) {
+			aa1[i] = rnd.axis();
+			aa1[i].w = rnd.range( -180, 180 );
+			aa2[i] = rnd.axis();
+			aa2[i].w = rnd.range( -180, 180 );
+			mats[i] = box.buildtransform( rnd.vec(-10, 10), rnd.vec(0.5f, 2), rnd.axis(), rnd.range(0, 360) );
+		}
+		bench( "multaa", 2000000 * scale, [&]( int i ) {
+			benchsink += box.multaa( aa1[i], aa2[i] ).w;
+		} );
+		bench( "transformpoints", 2000000 * scale, [&]( int i ) {
+			box.transformpoints( pshapes[box.shape].corners, dest, mats[i] );
+			benchsink += dest[7].x;
+		} );
+	}
+
+	///////////////////////////
+	// SpocTree.
+	{
+		// Same shape of world update() builds, filled with unit spheres.
+		const int numspheres = 10000;
+		static vec3 spos[numspheres];
+		static vec3 smoved[numspheres];
+		for( int s = 0; s < numspheres; s++ ) {
+			spos[s] = rnd.vec( -100, 100 ) + vec3( 10, 0, 10 );
+			smoved[s] = spos[s] + rnd.vec( -0.5f, 0.5f );
+		}
+
+		// buildtree() is expensive, time a few whole builds.
+		SpocTree tree;
+		tree.jobs = &pworld.jobs;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		const int numbuilds = 5 * scale;
+		for( int b = 0; b < numbuilds; b++ ) {
+			tree.clear();
+			for( int s = 0; s < numspheres; s++ )
+				tree.addsphere( spos[s], 1.0f );
+			tree.buildtree( 5, vec3(150, 150, 150), vec3(10.0f, 0.0f, 10.0f) );
+		}
+		double secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "buildtree (10k spheres)", numbuilds, secs );
+
+		bench( "getbucket", 1000000 * scale, [&]( int i ) {
+			benchsink += tree.getbucket( i * 7 % numspheres )->id;
+		} );
+
+		// refreshsphere() adds indices to buckets, clear them now and then
+		// so the buckets don't grow forever.
+		tree.reset();
+		bench( "refreshsphere", 1000000 * scale, [&]( int i ) {
+			int s = i * 7 % numspheres;
+			tree.refreshsphere( s, (i & 1) ? smoved[s] : spos[s] );
+			if( i == NUMINPUTS - 1 )
+				tree.reset();
+		} );
+
+		// A whole step's worth of refreshing, every sphere moved.
+		const int numsteps = 20 * scale;
+		auto refreshall = [&]( SpocTree &_tree ) {
+			for( int st = 0; st < numsteps; st++ ) {
+				_tree.reset();
+				for( int s = 0; s < numspheres; s++ )
+					_tree.refreshsphere( s, (st & 1) ? smoved[s] : spos[s] );
+			}
+		};
+		// Same, moved first and placed all at once like update() does.
+		static int all[numspheres];
+		for( int s = 0; s < numspheres; s++ )
+			all[s] = s;
+		auto placeall = [&]( SpocTree &_tree ) {
+			for( int st = 0; st < numsteps; st++ ) {
+				_tree.reset();
+				for( int s = 0; s < numspheres; s++ )
+					_tree.movesphere( s, (st & 1) ? smoved[s] : spos[s] );
+				_tree.placespheres( all, numspheres );
+			}
+		};
+		start = std::chrono::high_resolution_clock::now();
+		refreshall( tree );
+		secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "refresh step (10k spheres)", numsteps, secs );
+		start = std::chrono::high_resolution_clock::now();
+		placeall( tree );
+		secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "placespheres step (10k spheres)", numsteps, secs );
+
+		// Same again on a sparse tree.
+		SpocTree sparsetree;
+		sparsetree.jobs = &pworld.jobs;
+		sparsetree.sparse = true;
+		start = std::chrono::high_resolution_clock::now();
+		for( int b = 0; b < numbuilds; b++ ) {
+			sparsetree.clear();
+			for( int s = 0; s < numspheres; s++ )
+				sparsetree.addsphere( spos[s], 1.0f );
+			sparsetree.buildtree( 5, vec3(150, 150, 150), vec3(10.0f, 0.0f, 10.0f) );
+		}
+		secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "sparse buildtree (10k spheres)", numbuilds, secs );
+
+		start = std::chrono::high_resolution_clock::now();
+		refreshall( sparsetree );
+		secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "sparse refresh (10k spheres)", numsteps, secs );
+		start = std::chrono::high_resolution_clock::now();
+		placeall( sparsetree );
+		secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "sparse placespheres (10k spheres)", numsteps, secs );
+		printf( "nodes: full %d, sparse %d\n", tree.numnodes, sparsetree.numnodes );
+	}
+
+	///////////////////////////
+	// A million spheres, sparse, built in one go.
+	{
+		const int numspheres = 1000000;
+		SpocTree tree;
+		tree.jobs = &pworld.jobs;
+		tree.sparse = true;
+		for( int s = 0; s < numspheres; s++ )
+			tree.addsphere( rnd.vec( -1000, 1000 ), 1.0f );
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		tree.buildtree( 8, vec3(1000, 1000, 1000) );
+		double secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "sparse buildtree (1M spheres)", 1, secs );
+		printf( "nodes: %d\n", tree.numnodes );
+	}
+
+	///////////////////////////
+	// Whole steps. Most of the work is in one pile, the rest of the boxes
+	// are on their own, so splitting by area would leave threads idle.
+	{
+		const int numpile = 500;
+		const int numboxes = 1500;
+		static PBox pboxes[numboxes];
+		for( int b = 0; b < numpile; b++ )
+			pboxes[b] = PBox( vec3(-80.0f + (b % 10) * 1.2f, 10.6f + (b / 100) * 1.2f, -80.0f + (b / 10 % 10) * 1.2f) );
+		for( int b = numpile; b < numboxes; b++ )
+			pboxes[b] = randombox( rnd, vec3(rnd.range(-140, 140), 10.6f, rnd.range(-140, 140)) );
+		for( int b = 0; b < numboxes; b++ )
+			pboxes[b].setaccel( vec3(0, -0.001f, 0) );
+		sptree.clear();
+		sptree.sparse = true;
+		pworld.reset();
+		// Off the octree's middle, or every box on the ground straddles the
+		// root's split and stays in it.
+		pworld.addplane( PPlane(vec3(0, 1, 0), 10.0f) );
+		pworld.solver = PSOLVER_IMPULSE;
+		pworld.colorbatches = true;
+		// Settle in first, so the steps timed are the usual kind.
+		for( int s = 0; s < 10; s++ )
+			PBox::update( pboxes, numboxes );
+		const int numsteps = 10 * scale;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for( int s = 0; s < numsteps; s++ )
+			PBox::update( pboxes, numboxes );
+		double secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "impulse step (1.5k, pile)", numsteps, secs );
+
+		// Just the broadphase and narrowphase for the settled pile, without
+		// and with throwing out separated pairs first. Then with last call's
+		// separating axes kept around, like update() does.
+		const char *names[3] = { "collidepairs (pile)", "collidepairs, batchreject", "collidepairs, axis cache" };
+		for( int r = 0; r < 3; r++ ) {
+			pworld.batchreject = ( r > 0 );
+			const int numcalls = 20 * scale;
+			start = std::chrono::high_resolution_clock::now();
+			for( int c = 0; c < numcalls; c++ ) {
+				if( r == 2 )
+					pworld.nextstep();
+				else
+					pworld.reset();
+				PBox::collidepairs( pboxes, numboxes, true );
+			}
+			secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+			report( names[r], numcalls, secs );
+		}
+
+		// Same steps with two boxes out of three as debris, which doesn't
+		// hit other debris.
+		pworld.batchreject = true;
+		for( int b = 0; b < numboxes; b++ )
+			if( b % 3 )
+				pboxes[b].setlayers( 2, ~2u );
+		start = std::chrono::high_resolution_clock::now();
+		for( int s = 0; s < numsteps; s++ )
+			PBox::update( pboxes, numboxes );
+		secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "impulse step (1.5k, debris)", numsteps, secs );
+	}
+
+	///////////////////////////
+	// Churn. 20 boxes dropped in and 20 taken out every step. PBodies
+	// keeps the tree and warm starting, rebuilding starts both over.
+	{
+		const char *names[2] = { "churn step (1.5k, PBodies)", "churn step (1.5k, rebuild)" };
+		for( int r = 0; r < 2; r++ ) {
+			BenchRand crnd( seed );
+			PBodies bodies;
+			sptree.clear();
+			sptree.sparse = true;
+			pworld.reset();
+			std::vector <PHandle> live;
+			for( int b = 0; b < 1500; b++ ) {
+				live.push_back( bodies.add(randombox(crnd, vec3(crnd.range(-140, 140), 10.6f, crnd.range(-140, 140)))) );
+				bodies.boxes.back().setaccel( vec3(0, -0.001f, 0) );
+			}
+			for( int s = 0; s < 10; s++ )
+				bodies.update();
+			const int numsteps = 10 * scale;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for( int s = 0; s < numsteps; s++ ) {
+				for( int c = 0; c < 20; c++ ) {
+					int k = crnd.next() % live.size();
+					bodies.remove( live[k] );
+					live[k] = live.back();
+					live.pop_back();
+					live.push_back( bodies.add(randombox(crnd, vec3(crnd.range(-140, 140), 20.0f, crnd.range(-140, 140)))) );
+					bodies.boxes.back().setaccel( vec3(0, -0.001f, 0) );
+				}
+				if( r == 1 ) {
+					sptree.clear();
+					pworld.reset();
+				}
+				bodies.update();
+			}
+			double secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+			report( names[r], numsteps, secs );
+		}
+	}
+
+	///////////////////////////
+	// Space order. The same kind of scene, added in random order so
+	// neighbours are all over the array, then sorted.
+	{
+		const int numpile = 500;
+		const int numboxes = 1500;
+		BenchRand srnd( seed );
+		std::vector <PBox> scene;
+		for( int b = 0; b < numpile; b++ )
+			scene.push_back( PBox(vec3(-80.0f + (b % 10) * 1.2f, 10.6f + (b / 100) * 1.2f, -80.0f + (b / 10 % 10) * 1.2f)) );
+		for( int b = numpile; b < numboxes; b++ )
+			scene.push_back( randombox(srnd, vec3(srnd.range(-140, 140), 10.6f, srnd.range(-140, 140))) );
+		for( int b = numboxes - 1; b > 0; b-- )
+			std::swap( scene[b], scene[ srnd.next() % (b + 1) ] );
+		const char *names[2] = { "impulse step (1.5k, shuffled)", "impulse step (1.5k, sorted)" };
+		for( int r = 0; r < 2; r++ ) {
+			PBodies bodies;
+			for( int b = 0; b < numboxes; b++ ) {
+				bodies.add( scene[b] );
+				bodies.boxes.back().setaccel( vec3(0, -0.001f, 0) );
+			}
+			sptree.clear();
+			sptree.sparse = true;
+			pworld.reset();
+			if( r == 1 )
+				bodies.sort();
+			for( int s = 0; s < 10; s++ )
+				bodies.update();
+			const int numsteps = 10 * scale;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for( int s = 0; s < numsteps; s++ )
+				bodies.update();
+			double secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+			report( names[r], numsteps, secs );
+		}
+	}
+
+	///////////////////////////
+	// Small worlds. A 50 box pile stepped in pworld, then a thousand of
+	// them batched over the same threads.
+	{
+		const int numworlds = 1000;
+		const int numboxes = 50;
+		PBox scene[numboxes];
+		for( int b = 0; b < numboxes; b++ ) {
+			scene[b] = randombox( rnd, vec3((b % 5) * 2.0f, 1.0f + (b / 25) * 2.0f, (b / 5 % 5) * 2.0f) );
+			scene[b].setaccel( vec3(0, -0.001f, 0) );
+		}
+		PBox alone[numboxes];
+		for( int b = 0; b < numboxes; b++ )
+			alone[b] = scene[b];
+		sptree.clear();
+		pworld.reset();
+		pworld.clearground();
+		pworld.addplane( PPlane(vec3(0, 1, 0), 0.0f) );
+		pworld.solver = PSOLVER_IMPULSE;
+		pworld.colorbatches = false;
+		for( int s = 0; s < 10; s++ )
+			PBox::update( alone, numboxes );
+		const int numsteps = 200 * scale;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for( int s = 0; s < numsteps; s++ )
+			PBox::update( alone, numboxes );
+		double secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "world step (50, pworld)", numsteps, secs );
+
+		PWorlds batch;
+		batch.jobs.setthreads( pworld.jobs.threads(), ( argc > 4 ) && atoi( argv[4] ) );
+		for( int w = 0; w < numworlds; w++ ) {
+			int idx = batch.add( scene, numboxes );
+			batch.world( idx ).addplane( PPlane(vec3(0, 1, 0), 0.0f) );
+			batch.world( idx ).solver = PSOLVER_IMPULSE;
+		}
+		batch.update( 10 );
+		const int numupdates = scale;
+		start = std::chrono::high_resolution_clock::now();
+		for( int u = 0; u < numupdates; u++ )
+			batch.update( 10 );
+		secs = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+		report( "world steps (1k x 50, batch)", (long long)numupdates * 10 * numworlds, secs );
+	}
+
+	return 0;
+}
@@ -4,57 +4,206 @@
 // 
 // Contains data about a collision between two PBox's...
 // * XYZ for point of collision.
-// * Face and normal info for collision point.
+// * Face index and normal for collision point.
+// * At most 4 points, picked from everything collide() finds.
+// * Boxes as center/axes/half sizes(PBoxOBB), for throwing out pairs 8 at
+//   a time before collide()(see PBox::rejectpairs()), and the axis that
+//   threw each one out(PAXIS_).
 // 
 ///////////////////////////////////////////////////////////////////////////////
+#ifndef PCOLLISION_H
+#define PCOLLISION_H
 
 // 4x4 Mat's and Vec3's.
 #include "GLM_Lite.h"
 
+///////////////////////////////////////////////////////////////////////////////
+// Most points kept for one collision. Four corners are enough to hold a box
+// flat on a face, the rest just repeat them.
+const int PCOLLISION_MAXPOINTS = 4;
+// Most points collide() can find before reducing. 12 lines, 2 faces each,
+// both ways.
+const int PCOLLISION_MAXRAW = 48;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Point of collision between two boxes.
 class PCPoint {
 	public:
 		// 0 for box 1, 1 for box 2.
 		int boxid;
+		// Index of the face the point was detected on(see generatefaces()).
+		int faceidx;
 		// Point of collision.
 		vec3 pnt;
-		// The face the point was detected on.
-		vec3 face[4];
-		// That face's index.
-		int faceidx;
 		// Face normal.
 		vec3 fnormal;
 		// Dummy default constructor.
 		PCPoint() {}
 		// Parameterized Constructor.
 		// Can add all data needed to describe collision point.
-		PCPoint( const int _boxid, int _faceidx, const vec3 &_point, const vec3 _face[4], const vec3 _facenormal ) {
+		PCPoint( const int _boxid, int _faceidx, const vec3 &_point, const vec3 _facenormal ) {
 			boxid = _boxid;
 			faceidx = _faceidx;
 			pnt = _point;
-			for( int f = 0; f < 4; f++ )
-				face[f] = _face[f];
 			fnormal = _facenormal;
 		}
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Lines, faces and face normals for one box. What collision() builds from
+// a box's 8 points. Static boxes keep one around so it's built only once.
+class PBoxGeom {
+	public:
+		// 12 lines, 2 end points.
+		vec3 lines[12][2];
+		// 6 faces with 4 points.
+		vec3 faces[6][4];
+		// 6 xyz normals.
+		vec3 fnormals[6];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Pairs PBox::rejectpairs() tests at once. 8 floats fill an AVX register.
+const int PCOLLISION_BATCH = 8;
+// Gap(per unit of box size) a pair needs before rejectpairs() throws it out.
+// collide() finds points on boxes a hair apart, so only clearly separated
+// pairs go.
+const float PCOLLISION_SATSLOP = 0.01f;
+
+///////////////////////////////////////////////////////////////////////////////
+// What rejectpairs() found kept a pair apart. Kept per pair, so next step
+// tries the same one first.
+enum {
+	// Not apart, on to collision().
+	PAXIS_NONE = 0,
+	// Spheres.
+	PAXIS_SPHERE,
+	// World aligned boxes.
+	PAXIS_WORLD,
+	// Box a's face axes, + 0 to 2.
+	PAXIS_FACEA,
+	// Box b's face axes, + 0 to 2.
+	PAXIS_FACEB = PAXIS_FACEA + 3,
+	// a's axis i crossed with b's axis j, + i * 3 + j.
+	PAXIS_EDGE = PAXIS_FACEB + 3
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// A box as a center, 3 unit axes and half sizes. Plus the world aligned box
+// around it and its sphere, for the cheaper checks first.
+class PBoxOBB {
+	public:
+		vec3 center;
+		// Box x/y/z axes, unit length.
+		vec3 axes[3];
+		// Half width/height/depth.
+		float half[3];
+		// Half sizes of the world aligned box around it.
+		vec3 extent;
+		// Sphere radius(largestaxis).
+		float radius;
+		// True if every number matches, so collide() would see the same box.
+		bool same( const PBoxOBB &_obb ) const {
+			for( int ax = 0; ax < 3; ax++ )
+				if( axes[ax].x != _obb.axes[ax].x || axes[ax].y != _obb.axes[ax].y ||
+					axes[ax].z != _obb.axes[ax].z || half[ax] != _obb.half[ax] )
+					return false;
+			return center.x == _obb.center.x && center.y == _obb.center.y &&
+				   center.z == _obb.center.z && radius == _obb.radius;
+		}
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Collision Information between two PBoxes.
+// collide() can find dozens of points for a single pair, mostly the same few
+// corners over and over. Only the (up to) 4 that cover the most area are
+// kept, the one-face normals are worked out from all of them first.
 class PCollision {
 	public:
 		// Number of collision points.
 		int numcolpnts;
 		// The collision points.
-		PCPoint colpnts[50];
+		PCPoint colpnts[PCOLLISION_MAXPOINTS];
+		// One-face normals for box1 and box2(see averagenormals1f()).
+		vec3 box1norm;
+		vec3 box2norm;
 		// Def C-tor.
 		PCollision(): numcolpnts(0) {}
-		// Adds point to the list.
-		void addpoint( int _boxid, int _faceidx, const vec3 &_pnt, const vec3 _face[4], const vec3 _facenormal ) {
-			colpnts[ numcolpnts++ ] = PCPoint( _boxid, _faceidx, _pnt, _face, _facenormal );
+		// Empties the list.
+		void clear( void ) {
+			numcolpnts = 0;
+			box1norm = box2norm = vec3( 0, 0, 0 );
+		}
+		// Adds point to the list. Ignored once the list is full.
+		void addpoint( int _boxid, int _faceidx, const vec3 &_pnt, const vec3 _facenormal ) {
+			if( numcolpnts == PCOLLISION_MAXPOINTS )
+				return;
+			colpnts[ numcolpnts++ ] = PCPoint( _boxid, _faceidx, _pnt, _facenormal );
+			onefacenormals( colpnts, numcolpnts, box1norm, box2norm );
+		}
+		// Replaces the list with the best(up to) 4 of _numraw points.
+		void setpoints( const PCPoint *_raw, int _numraw ) {
+			clear();
+			if( _numraw == 0 )
+				return;
+			onefacenormals( _raw, _numraw, box1norm, box2norm );
+			if( _numraw <= PCOLLISION_MAXPOINTS ) {
+				for( int p = 0; p < _numraw; p++ )
+					colpnts[p] = _raw[p];
+				numcolpnts = _numraw;
+				return;
+			}
+			// 1. Farthest from the middle.
+			vec3 mid;
+			for( int p = 0; p < _numraw; p++ )
+				mid = mid + _raw[p].pnt;
+			mid = mid / _numraw;
+			int best = 0;
+			float bestval = -1.0f;
+			for( int p = 0; p < _numraw; p++ ) {
+				vec3 d = _raw[p].pnt - mid;
+				if( dot(d, d) > bestval ) { bestval = dot( d, d ); best = p; }
+			}
+			colpnts[ numcolpnts++ ] = _raw[best];
+			vec3 a = _raw[best].pnt;
+			// 2. Farthest from that.
+			bestval = 0.0f;
+			for( int p = 0; p < _numraw; p++ ) {
+				vec3 d = _raw[p].pnt - a;
+				if( dot(d, d) > bestval ) { bestval = dot( d, d ); best = p; }
+			}
+			// Everything on one spot.
+			if( bestval < 0.0001f )
+				return;
+			colpnts[ numcolpnts++ ] = _raw[best];
+			vec3 b = _raw[best].pnt;
+			// 3. Biggest triangle with those two.
+			bestval = 0.0f;
+			for( int p = 0; p < _numraw; p++ ) {
+				float area = magnitude( cross(b - a, _raw[p].pnt - a) );
+				if( area > bestval ) { bestval = area; best = p; }
+			}
+			// Everything on one line.
+			if( bestval < 0.0001f )
+				return;
+			colpnts[ numcolpnts++ ] = _raw[best];
+			vec3 c = _raw[best].pnt;
+			// 4. Adds the most area to that triangle. Points inside it add
+			// nothing.
+			float tri = bestval;
+			bestval = 0.0f;
+			for( int p = 0; p < _numraw; p++ ) {
+				vec3 d = _raw[p].pnt;
+				float area = magnitude( cross(b - a, d - a) ) + magnitude( cross(c - b, d - b) ) +
+							 magnitude( cross(a - c, d - c) ) - tri;
+				if( area > bestval ) { bestval = area; best = p; }
+			}
+			if( bestval < 0.0001f )
+				return;
+			colpnts[ numcolpnts++ ] = _raw[best];
 		}
 		// Calcs the average collision position.
-		vec3 averagepoint( void ) {
+		vec3 averagepoint( void ) const {
 			if( numcolpnts == 0 )
 				return vec3( -1000.0f, -1000.0f, -1000.0f );
 			vec3 avgpnt;
@@ -63,7 +212,7 @@ class PCollision {
 			return avgpnt / numcolpnts;
 		}
 		// Calcs average normals for box1 and box2.
-		void averagenormals( vec3 &_box1norm, vec3 &_box2norm ) {
+		void averagenormals( vec3 &_box1norm, vec3 &_box2norm ) const {
 			// Get the average normal from all faces involved.
 			for( int fn = 0; fn < numcolpnts; fn++ )
 				if( colpnts[fn].boxid == 0 )
@@ -72,6 +221,13 @@ class PCollision {
 					_box2norm = _box2norm + colpnts[fn].fnormal;
 		}
 		// Same as averagenormals(), but excludes all but one face.
+		// Worked out from every point found, before they were reduced(see
+		// onefacenormals()).
+		void averagenormals1f( vec3 &_box1norm, vec3 &_box2norm ) const {
+			_box1norm = _box1norm + box1norm;
+			_box2norm = _box2norm + box2norm;
+		}
+		// Normal of the face with the most points, for each box.
 		// Will average normals from multiple faces anyway if 
 		// there are an equal number of contact points on at least 
 		// two faces.
@@ -80,7 +236,8 @@ class PCollision {
 		// Since we would get collisions on side-faces too, the 
 		// averaged normal included a "sideways" vector, which would 
 		// wiggle the top box until it fell off.
-		void averagenormals1f( vec3 &_box1norm, vec3 &_box2norm ) {
+		static void onefacenormals( const PCPoint *_pnts, int _numpnts, vec3 &_box1norm, vec3 &_box2norm ) {
+			_box1norm = _box2norm = vec3( 0, 0, 0 );
 			// Count contact points for each face.
 			int highcntb1[6] = {0};
 			int highcntb2[6] = {0};
@@ -92,32 +249,32 @@ class PCollision {
 			int b2cpntidx = 0;
 			// Loop through every contact point and count for 
 			// every face.
-			for( int f = 0; f < numcolpnts; f++ ) {
+			for( int f = 0; f < _numpnts; f++ ) {
 				// First box.
-				if( colpnts[f].boxid == 0 ) {
+				if( _pnts[f].boxid == 0 ) {
 					// Go ahead and average the normal.
-					_box1norm = _box1norm + colpnts[f].fnormal;
+					_box1norm = _box1norm + _pnts[f].fnormal;
 					// Add a count to this face.
-					highcntb1[ colpnts[f].faceidx ]++;
+					highcntb1[ _pnts[f].faceidx ]++;
 					// The face we just counted has a higher number of hits 
 					// than the previous high, record it.
-					if( highcntb1[ colpnts[f].faceidx ] > highcntb1[b1high] ) {
+					if( highcntb1[ _pnts[f].faceidx ] > highcntb1[b1high] ) {
 						// Store previous high and current.
 						prevb1high = b1high;
-						b1high = colpnts[f].faceidx;
+						b1high = _pnts[f].faceidx;
 						b1cpntidx = f;
 					}
 				}
 				else { // Second box.
 					// Average the normal.
-					_box2norm = _box2norm + colpnts[f].fnormal;
+					_box2norm = _box2norm + _pnts[f].fnormal;
 					// Count face.
-					highcntb2[ colpnts[f].faceidx ]++;
+					highcntb2[ _pnts[f].faceidx ]++;
 					// Is it higher than the last?
-					if( highcntb2[ colpnts[f].faceidx ] > highcntb2[b2high] ) {
+					if( highcntb2[ _pnts[f].faceidx ] > highcntb2[b2high] ) {
 						// Store previous high and current.
 						prevb2high = b2high;
-						b2high = colpnts[f].faceidx;
+						b2high = _pnts[f].faceidx;
 						b2cpntidx = f;
 					}
 				}
@@ -126,11 +283,13 @@ class PCollision {
 			// If there is a tie, we'll just let the averaged normal pass 
 			// through.
 			if( highcntb1[b1high] > highcntb1[prevb1high] )
-				_box1norm = colpnts[b1cpntidx].fnormal;
+				_box1norm = _pnts[b1cpntidx].fnormal;
 			// 
 			if( highcntb2[b2high] > highcntb2[prevb2high] )
-				_box2norm = colpnts[b2cpntidx].fnormal;
+				_box2norm = _pnts[b2cpntidx].fnormal;
 			
 		}
 
 };
+
+#endif // PCOLLISION_H
@@ -0,0 +1,521 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PGoldenTool - Golden scene recorder/checker.
+//
+// Faster collision()/update() code has to give the same physics. This runs
+// a fixed set of seeded scenes and...
+// * record - writes every box's transform, velocity and contacts at a few
+//   checkpoint steps, plus a direct collision() probe of every close pair
+//   at the end, to one file per scene.
+// * compare - runs the same scenes with the current code, compares against
+//   the recorded files using the given tolerances and prints the divergence
+//   next to the speedup. Exits with 1 if any scene is outside tolerance, so
+//   scripts can accept or reject a change automatically.
+//
+// Usage:
+// PGoldenTool record golden
+// PGoldenTool compare golden [-pos 0.001] [-vel 0.001] [-pnt 0.001] [-cnt 0]
+//
+// -pos - max distance between recorded and current box corners.
+// -vel - max difference between velocities.
+// -pnt - max distance between matching contact points.
+// -cnt - max difference in contact point count per box or pair.
+//
+// Timings in the files come from the machine that recorded them. Record and
+// compare on the same machine for a meaningful speedup.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Timing.
+#include <chrono>
+// Sorting contact points.
+#include <vector>
+#include <algorithm>
+
+// Physics Box.
+#include "PBox.h"
+
+// File format version. Bump when the layout changes.
+const int GOLDENVERSION = 1;
+
+// Record every box this often(in steps).
+const int CHECKPOINTSTEPS = 50;
+
+///////////////////////////////////////////////////////////////////////////////
+// Small seeded generator(xorshift32). Same seed, same scene, any platform.
+struct GoldenRand {
+	unsigned int state;
+	GoldenRand( unsigned int _seed ): state( _seed ? _seed : 1 ) {}
+	unsigned int next( void ) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+	float range( float _lo, float _hi ) {
+		return _lo + ( _hi - _lo ) * ( next() & 0xFFFFFF ) / (float)0xFFFFFF;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// A scene in the corpus.
+struct GoldenScene {
+	const char *name;
+	int numboxes;
+	int steps;
+	bool deterministic;
+	// Sets up boxes for this scene.
+	void (*build)( PBox *_boxes, int _numboxes );
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// main.cpp's tower of falling boxes, every one of _numboxes, no ground.
+void buildstack( PBox *_boxes, int _numboxes ) {
+	vec3 vpos( 0, 1, 0 );
+	for( int bx = 0; bx < _numboxes; bx++ ) {
+		_boxes[bx] = PBox( vpos + vec3((bx % 2) * 0.5f, 1 + bx * 1.25f, 0), vec3(1, 1, 1), vec3(1, 1, 1), vec3(0, 0, 1), 0, true );
+		_boxes[bx].setvel( vec3(0, -0.01f, 0) );
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The tower falling onto a scaled ground box, the last box.
+void buildtower( PBox *_boxes, int _numboxes ) {
+	buildstack( _boxes, _numboxes - 1 );
+	_boxes[_numboxes - 1] = PBox( vec3(0, 0, 0), vec3(1, 1, 1), vec3(4, 1, 4), vec3(0, 0, 1), 0, false );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Randomly rotated boxes dropped into a loose pile on the ground.
+void buildpile( PBox *_boxes, int _numboxes ) {
+	GoldenRand rnd( 1234 );
+	for( int bx = 0; bx < _numboxes - 1; bx++ ) {
+		vec3 pos( rnd.range(-1.5f, 1.5f), 1.5f + bx * 0.6f, rnd.range(-1.5f, 1.5f) );
+		vec3 axis = normalize( vec3(rnd.range(-1, 1), rnd.range(-1, 1), rnd.range(-1, 1)) + vec3(0, 0.01f, 0) );
+		_boxes[bx] = PBox( pos, vec3(1, 1, 1), vec3(1, 1, 1), axis, rnd.range(0, 90), true );
+		_boxes[bx].setvel( vec3(0, -0.02f, 0) );
+	}
+	_boxes[_numboxes - 1] = PBox( vec3(0, 0, 0), vec3(1, 1, 1), vec3(4, 1, 4), vec3(0, 0, 1), 0, false );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pairs of boxes flying into each other, no ground.
+void buildpairs( PBox *_boxes, int _numboxes ) {
+	GoldenRand rnd( 99 );
+	for( int bx = 0; bx + 1 < _numboxes; bx += 2 ) {
+		vec3 base( (bx / 2) * 6.0f, 5, 0 );
+		float ang = rnd.range( 0, 45 );
+		_boxes[bx] = PBox( base + vec3(-1.5f, 0, 0), vec3(1, 1, 1), vec3(1, 1, 1), vec3(0, 1, 0), ang, true );
+		_boxes[bx + 1] = PBox( base + vec3(1.5f, rnd.range(-0.4f, 0.4f), 0), vec3(1, 1, 1), vec3(1, 1, 1), vec3(1, 0, 0), -ang, true );
+		_boxes[bx].setvel( vec3(0.02f, 0, 0) );
+		_boxes[bx + 1].setvel( vec3(-0.02f, 0, 0) );
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A grid of boxes sitting on the ground. Mostly box/ground contacts.
+void buildresting( PBox *_boxes, int _numboxes ) {
+	for( int bx = 0; bx < _numboxes - 1; bx++ ) {
+		vec3 pos( (bx % 3) * 1.2f - 1.2f, 1.02f, (bx / 3) * 1.2f - 1.2f );
+		_boxes[bx] = PBox( pos, vec3(1, 1, 1), vec3(1, 1, 1), vec3(0, 1, 0), bx * 10.0f, true );
+		_boxes[bx].setvel( vec3(0, -0.01f, 0) );
+	}
+	_boxes[_numboxes - 1] = PBox( vec3(0, 0, 0), vec3(1, 1, 1), vec3(4, 1, 4), vec3(0, 0, 1), 0, false );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The tower again, landing on a plane instead of a ground box.
+void buildtowerplane( PBox *_boxes, int _numboxes ) {
+	buildstack( _boxes, _numboxes );
+	pworld.addplane( PPlane(vec3(0, 1, 0), 0.5f) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tilted boxes dropped onto a bumpy heightfield.
+void buildheightfield( PBox *_boxes, int _numboxes ) {
+	GoldenRand rnd( 777 );
+	const int numsamples = 9;
+	float heights[numsamples * numsamples];
+	for( int h = 0; h < numsamples * numsamples; h++ )
+		heights[h] = rnd.range( 0.0f, 0.5f );
+	pworld.addheightfield( PHeightfield(vec3(-4, 0, -4), 1.0f, numsamples, numsamples, heights) );
+	for( int bx = 0; bx < _numboxes; bx++ ) {
+		vec3 pos( (bx % 4) * 1.5f - 2.25f, 2.0f + (bx / 16) * 1.5f, ((bx / 4) % 4) * 1.5f - 2.25f );
+		_boxes[bx] = PBox( pos, vec3(1, 1, 1), vec3(1, 1, 1), vec3(1, 0, 1), rnd.range(0, 30), true );
+		_boxes[bx].setvel( vec3(0, -0.02f, 0) );
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A stack of boxes under gravity on a plane, impulse solver with split
+// impulses.
+void buildstackimpulse( PBox *_boxes, int _numboxes ) {
+	pworld.solver = PSOLVER_IMPULSE;
+	pworld.correction = PCORRECT_SPLIT;
+	for( int bx = 0; bx < _numboxes; bx++ ) {
+		_boxes[bx] = PBox( vec3((bx % 2) * 0.1f, 0.51f + bx, 0), vec3(1, 1, 1), vec3(1, 1, 1), vec3(0, 0, 1), 0, true );
+		_boxes[bx].setaccel( vec3(0, -0.002f, 0) );
+	}
+	pworld.addplane( PPlane(vec3(0, 1, 0), 0.0f) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The pile again under gravity, impulse solver with Baumgarte.
+void buildpileimpulse( PBox *_boxes, int _numboxes ) {
+	buildpile( _boxes, _numboxes );
+	pworld.solver = PSOLVER_IMPULSE;
+	pworld.correction = PCORRECT_BAUMGARTE;
+	for( int bx = 0; bx < _numboxes - 1; bx++ )
+		_boxes[bx].setaccel( vec3(0, -0.002f, 0) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pile_impulse on a sparse octree. Should match pile_impulse.
+void buildpilesparse( PBox *_boxes, int _numboxes ) {
+	buildpileimpulse( _boxes, _numboxes );
+	sptree.sparse = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pile_sparse, way outside the octree's starting size. The tree has to grow.
+void buildpilefar( PBox *_boxes, int _numboxes ) {
+	buildpilesparse( _boxes, _numboxes );
+	for( int bx = 0; bx < _numboxes; bx++ )
+		_boxes[bx].setpos( _boxes[bx].pos + vec3(1000, 0, -600) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The corpus.
+const GoldenScene scenes[] = {
+	{ "tower",         100, 300, false, buildtower },
+	{ "tower_det",     100, 300, true,  buildtower },
+	{ "pile",           60, 400, false, buildpile },
+	{ "pile_det",       60, 400, true,  buildpile },
+	{ "pairs",          40, 200, false, buildpairs },
+	{ "pairs_det",      40, 200, true,  buildpairs },
+	{ "resting",        10, 200, false, buildresting },
+	{ "tower_plane",    99, 300, false, buildtowerplane },
+	{ "heightfield",    16, 300, true,  buildheightfield },
+	{ "stack_impulse",  10, 300, false, buildstackimpulse },
+	{ "pile_impulse",   60, 400, false, buildpileimpulse },
+	{ "pile_sparse",    60, 400, false, buildpilesparse },
+	{ "pile_far",       60, 400, false, buildpilefar },
+};
+const int NUMSCENES = sizeof(scenes) / sizeof(scenes[0]);
+
+///////////////////////////////////////////////////////////////////////////////
+// What we keep for one box at a checkpoint.
+struct GoldenBox {
+	vec3 corners[8];
+	vec3 vel;
+	int numcolpnts;
+	vec3 avgpnt;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// collision() result for one ordered pair at the end of the scene.
+// Points are sorted so order changes in collision() don't matter.
+struct GoldenProbe {
+	int a;
+	int b;
+	std::vector <vec3> pnts;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Everything recorded for one scene.
+struct GoldenResult {
+	double ms;
+	// checkpoints[c][box]
+	std::vector < std::vector <GoldenBox> > checkpoints;
+	std::vector <GoldenProbe> probes;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Lexicographic point order for sorting contact points.
+bool pntless( const vec3 &_p1, const vec3 &_p2 ) {
+	if( _p1.x != _p2.x ) return _p1.x < _p2.x;
+	if( _p1.y != _p2.y ) return _p1.y < _p2.y;
+	return _p1.z < _p2.z;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs a scene with the current code.
+void runscene( const GoldenScene &_scene, GoldenResult &_result ) {
+	std::vector <PBox> boxes( _scene.numboxes );
+	pworld.clearground();
+	pworld.solver = PSOLVER_NUDGE;
+	sptree.sparse = false;
+	_scene.build( &boxes[0], _scene.numboxes );
+
+	// Fresh world and octree for every scene.
+	sptree.clear();
+	pworld.reset();
+	pworld.deterministic = _scene.deterministic;
+
+	_result.ms = 0.0;
+	_result.checkpoints.clear();
+	_result.probes.clear();
+
+	for( int s = 1; s <= _scene.steps; s++ ) {
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		PBox::update( &boxes[0], _scene.numboxes );
+		_result.ms += std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now() - start ).count();
+
+		if( s % CHECKPOINTSTEPS != 0 && s != _scene.steps )
+			continue;
+		std::vector <GoldenBox> cp( _scene.numboxes );
+		for( int b = 0; b < _scene.numboxes; b++ ) {
+			boxes[b].points( cp[b].corners );
+			cp[b].vel = boxes[b].vel;
+			cp[b].numcolpnts = boxes[b].pc.numcolpnts;
+			cp[b].avgpnt = ( cp[b].numcolpnts > 0 ) ? boxes[b].pc.averagepoint() : vec3( 0, 0, 0 );
+		}
+		_result.checkpoints.push_back( cp );
+	}
+
+	// Probe collision() directly for every ordered pair that passes the
+	// sphere check.
+	PCollision pc;
+	for( int a = 0; a < _scene.numboxes; a++ ) {
+		for( int b = 0; b < _scene.numboxes; b++ ) {
+			if( a == b ) continue;
+			boxes[a].collision( pc, boxes[b] );
+			if( pc.numcolpnts == 0 ) continue;
+			GoldenProbe probe;
+			probe.a = a;
+			probe.b = b;
+			for( int p = 0; p < pc.numcolpnts; p++ )
+				probe.pnts.push_back( pc.colpnts[p].pnt );
+			std::sort( probe.pnts.begin(), probe.pnts.end(), pntless );
+			_result.probes.push_back( probe );
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes a result. %.9g round-trips floats exactly.
+bool writeresult( const char *_filename, const GoldenScene &_scene, const GoldenResult &_result ) {
+	FILE *file = fopen( _filename, "w" );
+	if( !file ) return false;
+	fprintf( file, "pboxgolden %d\n", GOLDENVERSION );
+	fprintf( file, "scene %s %d %d %d\n", _scene.name, _scene.numboxes, _scene.steps, _scene.deterministic ? 1 : 0 );
+	fprintf( file, "time %.6f\n", _result.ms );
+	fprintf( file, "checkpoints %d\n", (int)_result.checkpoints.size() );
+	for( unsigned int c = 0; c < _result.checkpoints.size(); c++ ) {
+		for( int b = 0; b < _scene.numboxes; b++ ) {
+			const GoldenBox &gb = _result.checkpoints[c][b];
+			for( int p = 0; p < 8; p++ )
+				fprintf( file, "%.9g %.9g %.9g ", gb.corners[p].x, gb.corners[p].y, gb.corners[p].z );
+			fprintf( file, "%.9g %.9g %.9g %d %.9g %.9g %.9g\n", gb.vel.x, gb.vel.y, gb.vel.z,
+					 gb.numcolpnts, gb.avgpnt.x, gb.avgpnt.y, gb.avgpnt.z );
+		}
+	}
+	fprintf( file, "probes %d\n", (int)_result.probes.size() );
+	for( unsigned int p = 0; p < _result.probes.size(); p++ ) {
+		const GoldenProbe &gp = _result.probes[p];
+		fprintf( file, "%d %d %d", gp.a, gp.b, (int)gp.pnts.size() );
+		for( unsigned int c = 0; c < gp.pnts.size(); c++ )
+			fprintf( file, " %.9g %.9g %.9g", gp.pnts[c].x, gp.pnts[c].y, gp.pnts[c].z );
+		fprintf( file, "\n" );
+	}
+	fclose( file );
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads a point.
+bool readvec( FILE *_file, vec3 &_v ) {
+	return fscanf( _file, "%f %f %f", &_v.x, &_v.y, &_v.z ) == 3;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads a result written by writeresult(). Returns false if the file is
+// missing, for another scene or a different version.
+bool readresult( const char *_filename, const GoldenScene &_scene, GoldenResult &_result ) {
+	FILE *file = fopen( _filename, "r" );
+	if( !file ) return false;
+	int version = 0, numboxes = 0, steps = 0, det = 0, numcps = 0, numprobes = 0;
+	char name[64] = {0};
+	bool ok = fscanf( file, " pboxgolden %d", &version ) == 1 && version == GOLDENVERSION;
+	ok = ok && fscanf( file, " scene %63s %d %d %d", name, &numboxes, &steps, &det ) == 4;
+	ok = ok && strcmp( name, _scene.name ) == 0 && numboxes == _scene.numboxes && steps == _scene.steps;
+	ok = ok && fscanf( file, " time %lf", &_result.ms ) == 1;
+	ok = ok && fscanf( file, " checkpoints %d", &numcps ) == 1;
+	_result.checkpoints.clear();
+	for( int c = 0; ok && c < numcps; c++ ) {
+		std::vector <GoldenBox> cp( numboxes );
+		for( int b = 0; ok && b < numboxes; b++ ) {
+			for( int p = 0; ok && p < 8; p++ )
+				ok = readvec( file, cp[b].corners[p] );
+			ok = ok && readvec( file, cp[b].vel );
+			ok = ok && fscanf( file, "%d", &cp[b].numcolpnts ) == 1;
+			ok = ok && readvec( file, cp[b].avgpnt );
+		}
+		_result.checkpoints.push_back( cp );
+	}
+	ok = ok && fscanf( file, " probes %d", &numprobes ) == 1;
+	_result.probes.clear();
+	for( int p = 0; ok && p < numprobes; p++ ) {
+		GoldenProbe gp;
+		int numpnts = 0;
+		ok = fscanf( file, "%d %d %d", &gp.a, &gp.b, &numpnts ) == 3;
+		for( int c = 0; ok && c < numpnts; c++ ) {
+			vec3 pnt;
+			ok = readvec( file, pnt );
+			gp.pnts.push_back( pnt );
+		}
+		_result.probes.push_back( gp );
+	}
+	fclose( file );
+	return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tolerances for compare.
+struct GoldenTolerance {
+	float pos;
+	float vel;
+	float pnt;
+	int cnt;
+	GoldenTolerance(): pos(0.001f), vel(0.001f), pnt(0.001f), cnt(0) {}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// How far apart two runs are.
+struct GoldenDivergence {
+	float pos;
+	float vel;
+	float pnt;
+	int cnt;
+	// Probes only one side has.
+	int missingprobes;
+	GoldenDivergence(): pos(0), vel(0), pnt(0), cnt(0), missingprobes(0) {}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+float distance( const vec3 &_p1, const vec3 &_p2 ) {
+	return magnitude( (vec3)_p1 - (vec3)_p2 );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Worst case difference between expected and current.
+void diverge( const GoldenResult &_expected, const GoldenResult &_current, GoldenDivergence &_div ) {
+	unsigned int numcps = std::min( _expected.checkpoints.size(), _current.checkpoints.size() );
+	for( unsigned int c = 0; c < numcps; c++ ) {
+		const std::vector <GoldenBox> &ecp = _expected.checkpoints[c];
+		const std::vector <GoldenBox> &ccp = _current.checkpoints[c];
+		for( unsigned int b = 0; b < ecp.size() && b < ccp.size(); b++ ) {
+			for( int p = 0; p < 8; p++ )
+				_div.pos = std::max( _div.pos, distance(ecp[b].corners[p], ccp[b].corners[p]) );
+			_div.vel = std::max( _div.vel, distance(ecp[b].vel, ccp[b].vel) );
+			_div.cnt = std::max( _div.cnt, abs(ecp[b].numcolpnts - ccp[b].numcolpnts) );
+			if( ecp[b].numcolpnts > 0 && ccp[b].numcolpnts > 0 )
+				_div.pnt = std::max( _div.pnt, distance(ecp[b].avgpnt, ccp[b].avgpnt) );
+		}
+	}
+
+	// Probes are in (a, b) order in both.
+	unsigned int ep = 0, cp = 0;
+	while( ep < _expected.probes.size() || cp < _current.probes.size() ) {
+		const GoldenProbe *e = ( ep < _expected.probes.size() ) ? &_expected.probes[ep] : 0;
+		const GoldenProbe *c = ( cp < _current.probes.size() ) ? &_current.probes[cp] : 0;
+		if( e && c && e->a == c->a && e->b == c->b ) {
+			_div.cnt = std::max( _div.cnt, abs((int)e->pnts.size() - (int)c->pnts.size()) );
+			// Every expected point should have a current point close by.
+			for( unsigned int p = 0; p < e->pnts.size(); p++ ) {
+				float best = 1e30f;
+				for( unsigned int q = 0; q < c->pnts.size(); q++ )
+					best = std::min( best, distance(e->pnts[p], c->pnts[q]) );
+				if( !c->pnts.empty() )
+					_div.pnt = std::max( _div.pnt, best );
+			}
+			ep++;
+			cp++;
+		}
+		else if( !c || (e && (e->a < c->a || (e->a == c->a && e->b < c->b))) ) {
+			_div.missingprobes++;
+			ep++;
+		}
+		else {
+			_div.missingprobes++;
+			cp++;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Builds "dir/scene.golden".
+void goldenpath( char *_path, int _size, const char *_dir, const char *_scene ) {
+	snprintf( _path, _size, "%s/%s.golden", _dir, _scene );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main( int argc, char **argv ) {
+	if( argc < 3 || (strcmp(argv[1], "record") != 0 && strcmp(argv[1], "compare") != 0) ) {
+		printf( "Usage: PGoldenTool record|compare <dir> [-pos t] [-vel t] [-pnt t] [-cnt n]\n" );
+		return 2;
+	}
+	bool record = strcmp( argv[1], "record" ) == 0;
+	const char *dir = argv[2];
+
+	GoldenTolerance tol;
+	for( int a = 3; a + 1 < argc; a += 2 ) {
+		if( strcmp(argv[a], "-pos") == 0 ) tol.pos = atof( argv[a + 1] );
+		else if( strcmp(argv[a], "-vel") == 0 ) tol.vel = atof( argv[a + 1] );
+		else if( strcmp(argv[a], "-pnt") == 0 ) tol.pnt = atof( argv[a + 1] );
+		else if( strcmp(argv[a], "-cnt") == 0 ) tol.cnt = atoi( argv[a + 1] );
+		else {
+			printf( "Unknown option %s\n", argv[a] );
+			return 2;
+		}
+	}
+
+	int failed = 0;
+	double totalexpected = 0.0, totalcurrent = 0.0;
+	for( int s = 0; s < NUMSCENES; s++ ) {
+		char path[512];
+		goldenpath( path, sizeof(path), dir, scenes[s].name );
+
+		GoldenResult current;
+		runscene( scenes[s], current );
+
+		if( record ) {
+			if( !writeresult(path, scenes[s], current) ) {
+				printf( "%-12s couldn't write %s\n", scenes[s].name, path );
+				failed++;
+				continue;
+			}
+			printf( "%-12s recorded %d checkpoints, %d probes, %.3fms\n", scenes[s].name,
+					(int)current.checkpoints.size(), (int)current.probes.size(), current.ms );
+			continue;
+		}
+
+		GoldenResult expected;
+		if( !readresult(path, scenes[s], expected) ) {
+			printf( "%-12s FAIL couldn't read %s\n", scenes[s].name, path );
+			failed++;
+			continue;
+		}
+		GoldenDivergence div;
+		diverge( expected, current, div );
+		bool pass = div.pos <= tol.pos && div.vel <= tol.vel && div.pnt <= tol.pnt &&
+					div.cnt <= tol.cnt && div.missingprobes == 0 &&
+					expected.checkpoints.size() == current.checkpoints.size();
+		failed += pass ? 0 : 1;
+		totalexpected += expected.ms;
+		totalcurrent += current.ms;
+		printf( "%-12s %s pos %.6f vel %.6f pnt %.6f cnt %d probes %d | %.3fms vs %.3fms %.2fx\n",
+				scenes[s].name, pass ? "PASS" : "FAIL", div.pos, div.vel, div.pnt, div.cnt,
+				div.missingprobes, current.ms, expected.ms,
+				current.ms > 0.0 ? expected.ms / current.ms : 0.0 );
+	}
+
+	if( !record && totalcurrent > 0.0 )
+		printf( "total %.3fms vs %.3fms %.2fx, %d failed\n", totalcurrent, totalexpected,
+				totalexpected / totalcurrent, failed );
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PGround - Ground Primitives(for PBox)
+//
+// Floors don't need to be giant PBoxes. These are static shapes PBoxes
+// collide with directly, without the octree...
+// * PPlane - infinite plane.
+// * PHeightfield - grid of heights, bilinear between samples.
+//
+// Box against either is a dot product(or height lookup) per corner, no
+// line to face checks.
+//
+// Usage:
+// pworld.addplane( PPlane(vec3(0, 1, 0), 0.5f) );
+// PBox::update( pboxes, 10 );
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PGROUND_H
+#define PGROUND_H
+
+// Lists of things.
+#include <vector>
+// floor() and such.
+#include <math.h>
+
+// vectors and such.
+#include "GLM_Lite.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Infinite plane. Every point p with dot(normal, p) == offset is on it.
+// normal points out of the ground, toward the side boxes sit on.
+class PPlane {
+	public:
+		vec3 normal;
+		float offset;
+
+		// Normal and offset along it. Defaults to a floor at y = 0.
+		PPlane( const vec3 &_normal = vec3(0, 1, 0), float _offset = 0.0f ) {
+			normal = normalize( _normal );
+			offset = _offset;
+		}
+
+		// Signed distance from plane to point. Negative is below/inside.
+		float distance( const vec3 &_pnt ) const {
+			return dot( normal, _pnt ) - offset;
+		}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Height samples on a regular x/z grid. Heights are relative to origin.y
+// and interpolated bilinearly between samples. Outside the grid there is no
+// ground.
+class PHeightfield {
+	public:
+		// World position of the first sample(lowest x and z).
+		vec3 origin;
+		// Distance between samples, on x and on z.
+		float spacing;
+		// Number of samples along x and along z.
+		int numx;
+		int numz;
+		// numx * numz heights, x first. heights[z * numx + x].
+		std::vector <float> heights;
+		// Lowest and highest sample, world y. Used for quick rejects.
+		float miny;
+		float maxy;
+
+		// Dummy default constructor.
+		PHeightfield(): spacing(1.0f), numx(0), numz(0), miny(0.0f), maxy(0.0f) {}
+
+		// Copies _numx * _numz heights.
+		PHeightfield( const vec3 &_origin, float _spacing, int _numx, int _numz, const float *_heights ) {
+			origin = _origin;
+			spacing = _spacing;
+			numx = _numx;
+			numz = _numz;
+			heights.assign( _heights, _heights + _numx * _numz );
+			miny = maxy = origin.y + ( heights.empty() ? 0.0f : heights[0] );
+			for( unsigned int h = 0; h < heights.size(); h++ ) {
+				miny = ( origin.y + heights[h] < miny ) ? origin.y + heights[h] : miny;
+				maxy = ( origin.y + heights[h] > maxy ) ? origin.y + heights[h] : maxy;
+			}
+		}
+
+		// Largest x/z still on the grid.
+		float maxx( void ) const { return origin.x + ( numx - 1 ) * spacing; }
+		float maxz( void ) const { return origin.z + ( numz - 1 ) * spacing; }
+
+		// True if x/z is over the grid.
+		bool inside( float _x, float _z ) const {
+			return numx > 1 && numz > 1 &&
+				   _x >= origin.x && _x <= maxx() && _z >= origin.z && _z <= maxz();
+		}
+
+		// World height at x/z. Only valid when inside(). Also gives the
+		// surface normal if _normal isn't 0.
+		float height( float _x, float _z, vec3 *_normal = 0 ) const {
+			// Cell and position within it(0-1).
+			float gx = ( _x - origin.x ) / spacing;
+			float gz = ( _z - origin.z ) / spacing;
+			int cx = (int)floor( gx );
+			int cz = (int)floor( gz );
+			cx = ( cx > numx - 2 ) ? numx - 2 : cx;
+			cz = ( cz > numz - 2 ) ? numz - 2 : cz;
+			float tx = gx - cx;
+			float tz = gz - cz;
+			// Corner heights.
+			float h00 = heights[ cz * numx + cx ];
+			float h10 = heights[ cz * numx + cx + 1 ];
+			float h01 = heights[ (cz + 1) * numx + cx ];
+			float h11 = heights[ (cz + 1) * numx + cx + 1 ];
+			// Slopes along x and z at this point.
+			if( _normal ) {
+				float dhdx = ( (h10 - h00) * (1 - tz) + (h11 - h01) * tz ) / spacing;
+				float dhdz = ( (h01 - h00) * (1 - tx) + (h11 - h10) * tx ) / spacing;
+				*_normal = normalize( vec3(-dhdx, 1, -dhdz) );
+			}
+			return origin.y + ( h00 * (1 - tx) + h10 * tx ) * (1 - tz) +
+							  ( h01 * (1 - tx) + h11 * tx ) * tz;
+		}
+};
+
+#endif // PGROUND_H
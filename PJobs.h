@@ -0,0 +1,440 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PJobs - Worker Threads(for PBox)
+//
+// A fixed set of worker threads that steal work from each other...
+// * setthreads() starts or stops workers, and can pin them to cores.
+//   Nothing else does, stepping never creates a thread.
+// * add() queues a job, fn( idx, lane ) for a range of indices, and
+//   after() makes one job wait for another. run() runs them all, the
+//   calling thread helping, and returns once they're done.
+// * Every thread has its own queue. A job's range goes in the queue of
+//   the thread that let it start, and gets cut in half as it's taken, the
+//   top half left behind. Threads with nothing to do steal the biggest
+//   pieces from the front of other queues, so a pile in one corner of the
+//   scene doesn't leave the other threads idle.
+// * parallelfor() is add() and run() in one. Called from inside a job, it
+//   queues its range and helps with whatever's around until it's done.
+// * Every thread has a lane, 0 for the caller and 1 on up for workers, so
+//   jobs can keep per thread scratch(arenas and such) without locking.
+//   lane() is the calling thread's.
+// * Scope borrows a lane for the calling thread, for stepping something
+//   with its own pool from inside another pool's job(see PWorlds.h).
+//
+// With 1 thread(the default) jobs just run on the calling thread.
+//
+// Usage:
+// pworld.jobs.setthreads( 4 );
+// pworld.jobs.parallelfor( 100, [&]( int _idx, int _lane ) { ... } );
+//
+// int a = pworld.jobs.add( 100, fna );
+// int b = pworld.jobs.add( 1, fnb );
+// pworld.jobs.after( b, a );
+// pworld.jobs.run();
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PJOBS_H
+#define PJOBS_H
+
+// Workers.
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+// Lists of things.
+#include <vector>
+
+// Pinning threads to cores.
+#if defined( _WIN32 )
+// Just the thread calls, and no min/max macros breaking std::min()/std::max()
+// in every file that includes PBox.h.
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined( __linux__ )
+#include <pthread.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+class PJobs {
+	public:
+		PJobs(): numthreads(1), pinned(false), queues(new Queue[1]), quit(false), running(false),
+				 full(false) {
+			queued = 0;
+			sleepers = 0;
+			remaining = 0;
+			jobs.reserve( 64 );
+		}
+		~PJobs() {
+			setthreads( 1 );
+			delete [] queues;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Threads jobs run on, counting the caller. Starts or stops workers
+		// to match. _pin puts worker n on core n(the caller is left alone).
+		// Don't call it while jobs are running.
+		void setthreads( int _num, bool _pin = false ) {
+			_num = ( _num < 1 ) ? 1 : _num;
+			if( _num == numthreads && _pin == pinned )
+				return;
+			// Stop everyone, then start the right number.
+			{
+				std::lock_guard <std::mutex> lock( mutex );
+				quit = true;
+			}
+			wake.notify_all();
+			for( unsigned int w = 0; w < workers.size(); w++ )
+				workers[w].join();
+			workers.clear();
+			quit = false;
+			numthreads = _num;
+			pinned = _pin;
+			delete [] queues;
+			queues = new Queue[numthreads];
+			for( int w = 1; w < numthreads; w++ )
+				workers.push_back( std::thread( &PJobs::work, this, w ) );
+		}
+
+		int threads( void ) const { return numthreads; }
+
+		///////////////////////////////////////////////////////////////////////
+		// The calling thread's lane. 0 for any thread that isn't a worker.
+		static int lane( void ) { return threadlane(); }
+
+		///////////////////////////////////////////////////////////////////////
+		// Makes the calling thread lane _lane until it goes out of scope. A
+		// pool with 1 thread only has lane 0, so that's what a job stepping
+		// one from another pool's worker wants.
+		class Scope {
+			public:
+				Scope( int _lane ): oldlane(threadlane()) { threadlane() = _lane; }
+				~Scope() { threadlane() = oldlane; }
+			private:
+				int oldlane;
+		};
+
+		///////////////////////////////////////////////////////////////////////
+		// Queues a job calling _fn( idx, lane ) for every idx in [0, _count).
+		// Indices are handed out _grain or fewer at a time. _fn has to stay
+		// around until run() returns. Returns the job's id, for after().
+		template <class F>
+		int add( int _count, const F &_fn, int _grain = 1 ) {
+			Job job;
+			job.fn = &callfn<F>;
+			job.data = &_fn;
+			job.count = _count;
+			job.grain = ( _grain < 1 ) ? 1 : _grain;
+			job.left = _count;
+			job.waiting = 0;
+			job.numbefore = 0;
+			job.firstafter = -1;
+			jobs.push_back( job );
+			return jobs.size() - 1;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// _job doesn't start until _before is done. Both from add(), before
+		// run().
+		void after( int _job, int _before ) {
+			Edge edge = { _job, jobs[_before].firstafter };
+			jobs[_before].firstafter = edges.size();
+			edges.push_back( edge );
+			jobs[_job].waiting++;
+			jobs[_job].numbefore++;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Runs every job add()ed since the last run(), each once everything
+		// it's after() is done. Returns when they all are.
+		void run( void ) {
+			int numjobs = jobs.size();
+			if( numjobs == 0 )
+				return;
+			remaining = numjobs;
+			running = true;
+			// Not waiting, since a job could finish and start one that was
+			// before we get to it.
+			for( int j = 0; j < numjobs; j++ )
+				if( jobs[j].numbefore == 0 )
+					release( j, 0 );
+			while( remaining > 0 ) {
+				if( runone(0) )
+					continue;
+				// Nothing to steal, wait for more or for the end.
+				std::unique_lock <std::mutex> lock( mutex );
+				sleepers++;
+				while( remaining > 0 && queued == 0 )
+					wake.wait( lock );
+				sleepers--;
+			}
+			running = false;
+			jobs.clear();
+			edges.clear();
+			// A job inside ran out of room last time, make more for next.
+			if( full ) {
+				jobs.reserve( jobs.capacity() * 2 );
+				full = false;
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Calls _fn( idx, lane ) for every idx in [0, _count), spread over
+		// every thread, and returns when they're done. Fine to call from
+		// inside a job.
+		template <class F>
+		void parallelfor( int _count, const F &_fn, int _grain = 1 ) {
+			if( numthreads == 1 || _count <= _grain ) {
+				int lane = threadlane();
+				for( int i = 0; i < _count; i++ )
+					_fn( i, lane );
+				return;
+			}
+			if( !running ) {
+				add( _count, _fn, _grain );
+				run();
+				return;
+			}
+			// Inside a job. Other threads could be reading jobs, so only
+			// add if it won't move.
+			int job;
+			{
+				std::lock_guard <std::mutex> lock( addlock );
+				if( jobs.size() == jobs.capacity() ) {
+					full = true;
+					job = -1;
+				}
+				else {
+					job = add( _count, _fn, _grain );
+					remaining++;
+				}
+			}
+			int lane = threadlane();
+			if( job < 0 ) {
+				for( int i = 0; i < _count; i++ )
+					_fn( i, lane );
+				return;
+			}
+			release( job, lane );
+			while( jobs[job].left > 0 )
+				if( !runone(lane) )
+					std::this_thread::yield();
+		}
+
+	private:
+		// Type erased job, so starting one doesn't allocate.
+		typedef void (*JobFn)( const void *, int, int );
+		template <class F>
+		static void callfn( const void *_fn, int _idx, int _lane ) {
+			(*(const F *)_fn)( _idx, _lane );
+		}
+
+		struct Job {
+			JobFn fn;
+			const void *data;
+			int count;
+			int grain;
+			// Indices not done yet.
+			std::atomic <int> left;
+			// Jobs this is after() that aren't done yet, and all of them.
+			std::atomic <int> waiting;
+			int numbefore;
+			// First edge for jobs waiting on this one, -1 for none.
+			int firstafter;
+
+			Job() {}
+			// Only copied by jobs growing, while nothing's running.
+			Job( const Job &_job ) { *this = _job; }
+			Job &operator=( const Job &_job ) {
+				fn = _job.fn;
+				data = _job.data;
+				count = _job.count;
+				grain = _job.grain;
+				left = _job.left.load();
+				waiting = _job.waiting.load();
+				numbefore = _job.numbefore;
+				firstafter = _job.firstafter;
+				return *this;
+			}
+		};
+
+		// job waits on whichever job points at this, next is the next edge
+		// out of that one.
+		struct Edge {
+			int job;
+			int next;
+		};
+
+		// Indices [begin, end) of a job.
+		struct Piece {
+			int job;
+			int begin;
+			int end;
+		};
+
+		// One thread's pieces. The owner takes from the back, thieves from
+		// the front. Taken pieces before head stay until it's empty.
+		struct Queue {
+			std::mutex lock;
+			std::vector <Piece> pieces;
+			unsigned int head;
+			Queue(): head(0) {}
+		};
+
+		int numthreads;
+		bool pinned;
+		std::vector <std::thread> workers;
+		Queue *queues;
+		std::vector <Job> jobs;
+		std::vector <Edge> edges;
+
+		// Workers(and run()) sleep on wake when every queue is empty.
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool quit;
+		// Pieces in all the queues, and threads asleep.
+		std::atomic <int> queued;
+		std::atomic <int> sleepers;
+
+		// Jobs not done yet, for run().
+		std::atomic <int> remaining;
+		bool running;
+		// Jobs added from inside a job.
+		std::mutex addlock;
+		bool full;
+
+		static int &threadlane( void ) {
+			static thread_local int lane = 0;
+			return lane;
+		}
+
+		void push( int _lane, const Piece &_piece ) {
+			{
+				std::lock_guard <std::mutex> lock( queues[_lane].lock );
+				queues[_lane].pieces.push_back( _piece );
+			}
+			queued++;
+			if( sleepers > 0 ) {
+				std::lock_guard <std::mutex> lock( mutex );
+				wake.notify_all();
+			}
+		}
+
+		// Newest piece from our own queue.
+		bool pop( int _lane, Piece &_piece ) {
+			Queue &queue = queues[_lane];
+			std::lock_guard <std::mutex> lock( queue.lock );
+			if( queue.head == queue.pieces.size() )
+				return false;
+			_piece = queue.pieces.back();
+			queue.pieces.pop_back();
+			if( queue.head == queue.pieces.size() ) {
+				queue.pieces.clear();
+				queue.head = 0;
+			}
+			queued--;
+			return true;
+		}
+
+		// Oldest(biggest) piece from someone else's queue.
+		bool steal( int _lane, Piece &_piece ) {
+			for( int q = 1; q < numthreads; q++ ) {
+				Queue &queue = queues[ ( _lane + q ) % numthreads ];
+				std::lock_guard <std::mutex> lock( queue.lock );
+				if( queue.head == queue.pieces.size() )
+					continue;
+				_piece = queue.pieces[ queue.head++ ];
+				if( queue.head == queue.pieces.size() ) {
+					queue.pieces.clear();
+					queue.head = 0;
+				}
+				queued--;
+				return true;
+			}
+			return false;
+		}
+
+		// _job can start, its whole range goes in _lane's queue.
+		void release( int _job, int _lane ) {
+			if( jobs[_job].count <= 0 ) {
+				finish( _job, _lane );
+				return;
+			}
+			Piece piece = { _job, 0, jobs[_job].count };
+			push( _lane, piece );
+		}
+
+		// _job's last index is done, start whatever was waiting on it.
+		void finish( int _job, int _lane ) {
+			for( int e = jobs[_job].firstafter; e >= 0; e = edges[e].next )
+				if( --jobs[ edges[e].job ].waiting == 0 )
+					release( edges[e].job, _lane );
+			if( --remaining == 0 ) {
+				std::lock_guard <std::mutex> lock( mutex );
+				wake.notify_all();
+			}
+		}
+
+		// Runs one piece. False if there wasn't one anywhere.
+		bool runone( int _lane ) {
+			Piece piece;
+			if( !pop(_lane, piece) && !steal(_lane, piece) )
+				return false;
+			Job &job = jobs[ piece.job ];
+			// Leave the top half behind while there's more than a grain,
+			// for us later or for a thief.
+			while( numthreads > 1 && piece.end - piece.begin > job.grain ) {
+				Piece top = { piece.job, ( piece.begin + piece.end ) / 2, piece.end };
+				push( _lane, top );
+				piece.end = top.begin;
+			}
+			for( int i = piece.begin; i < piece.end; i++ )
+				job.fn( job.data, i, _lane );
+			if( ( job.left -= piece.end - piece.begin ) == 0 )
+				finish( piece.job, _lane );
+			return true;
+		}
+
+		// Puts the calling thread on core _core.
+		static void pin( int _core ) {
+			unsigned int cores = std::thread::hardware_concurrency();
+			if( cores == 0 ) return;
+			_core %= cores;
+#if defined( _WIN32 )
+			SetThreadAffinityMask( GetCurrentThread(), (DWORD_PTR)1 << _core );
+#elif defined( __linux__ )
+			cpu_set_t set;
+			CPU_ZERO( &set );
+			CPU_SET( _core, &set );
+			pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+#endif
+		}
+
+		// Worker thread.
+		void work( int _lane ) {
+			threadlane() = _lane;
+			if( pinned )
+				pin( _lane );
+			for( ;; ) {
+				if( runone(_lane) )
+					continue;
+				std::unique_lock <std::mutex> lock( mutex );
+				sleepers++;
+				while( !quit && queued == 0 )
+					wake.wait( lock );
+				sleepers--;
+				if( quit )
+					return;
+			}
+		}
+
+		// Threads can't be copied.
+		PJobs( const PJobs & );
+		PJobs &operator=( const PJobs & );
+};
+
+#endif // PJOBS_H
@@ -0,0 +1,246 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PMath - SIMD Math(for PBox)
+//
+// Small 4-wide math types for the collision and solver hot loops...
+// * pvec - x/y/z/w in one SSE register. dot3(), cross3(), normalize3() and
+//   friends only look at x/y/z.
+// * pmat34 - 3 axis columns(rotation and scale) plus a translation. All a
+//   box transform needs, with transformpoint() instead of a mat4 product.
+// * pquat - rotation quaternion, to and from axis-angle(degrees).
+//
+// GLM_Lite's vec3/mat4 are still what PBox hands out and takes in. These
+// convert to and from them, and the math inside is done in the same order
+// as the plain float versions, so results don't change.
+//
+// Uses SSE when the compiler has it(x64 always does). Define PBOX_NOSIMD
+// before including PBox.h for plain floats everywhere.
+//
+// Usage:
+// pmat34 m( box.mat );
+// pvec p = m.transformpoint( pvec(1, 2, 3, 1) );
+// float d = dot3( p, normalize3(pvec(0, 1, 0)) );
+// vec3 v = p.tovec3();
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PMATH_H
+#define PMATH_H
+
+// sqrt() and such.
+#include <math.h>
+
+// vec3/mat4, what these convert to and from.
+#include "GLM_Lite.h"
+
+#if !defined(PBOX_NOSIMD) && ( defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 ) )
+#define PMATH_SSE
+// SSE2 intrinsics.
+#include <emmintrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// 4 floats, worked on all at once.
+class pvec {
+	public:
+#ifdef PMATH_SSE
+		__m128 v;
+		pvec(): v( _mm_setzero_ps() ) {}
+		pvec( __m128 _v ): v(_v) {}
+		pvec( float _x, float _y, float _z, float _w = 0.0f ): v( _mm_setr_ps(_x, _y, _z, _w) ) {}
+		explicit pvec( const vec3 &_v ): v( _mm_setr_ps(_v.x, _v.y, _v.z, _v.w) ) {}
+		pvec( const vec3 &_v, float _w ): v( _mm_setr_ps(_v.x, _v.y, _v.z, _w) ) {}
+
+		float x( void ) const { return _mm_cvtss_f32( v ); }
+		float y( void ) const { return _mm_cvtss_f32( _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)) ); }
+		float z( void ) const { return _mm_cvtss_f32( _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)) ); }
+		float w( void ) const { return _mm_cvtss_f32( _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)) ); }
+		vec3 tovec3( void ) const {
+			float f[4];
+			_mm_storeu_ps( f, v );
+			return vec3( f[0], f[1], f[2], f[3] );
+		}
+
+		pvec operator+( const pvec &_o ) const { return _mm_add_ps( v, _o.v ); }
+		pvec operator-( const pvec &_o ) const { return _mm_sub_ps( v, _o.v ); }
+		pvec operator*( const pvec &_o ) const { return _mm_mul_ps( v, _o.v ); }
+		pvec operator*( float _s ) const { return _mm_mul_ps( v, _mm_set1_ps(_s) ); }
+		pvec operator/( float _s ) const { return _mm_div_ps( v, _mm_set1_ps(_s) ); }
+#else
+		float v[4];
+		pvec() { v[0] = v[1] = v[2] = v[3] = 0.0f; }
+		pvec( float _x, float _y, float _z, float _w = 0.0f ) { v[0] = _x; v[1] = _y; v[2] = _z; v[3] = _w; }
+		explicit pvec( const vec3 &_v ) { v[0] = _v.x; v[1] = _v.y; v[2] = _v.z; v[3] = _v.w; }
+		pvec( const vec3 &_v, float _w ) { v[0] = _v.x; v[1] = _v.y; v[2] = _v.z; v[3] = _w; }
+
+		float x( void ) const { return v[0]; }
+		float y( void ) const { return v[1]; }
+		float z( void ) const { return v[2]; }
+		float w( void ) const { return v[3]; }
+		vec3 tovec3( void ) const { return vec3( v[0], v[1], v[2], v[3] ); }
+
+		pvec operator+( const pvec &_o ) const { return pvec( v[0] + _o.v[0], v[1] + _o.v[1], v[2] + _o.v[2], v[3] + _o.v[3] ); }
+		pvec operator-( const pvec &_o ) const { return pvec( v[0] - _o.v[0], v[1] - _o.v[1], v[2] - _o.v[2], v[3] - _o.v[3] ); }
+		pvec operator*( const pvec &_o ) const { return pvec( v[0] * _o.v[0], v[1] * _o.v[1], v[2] * _o.v[2], v[3] * _o.v[3] ); }
+		pvec operator*( float _s ) const { return pvec( v[0] * _s, v[1] * _s, v[2] * _s, v[3] * _s ); }
+		pvec operator/( float _s ) const { return pvec( v[0] / _s, v[1] / _s, v[2] / _s, v[3] / _s ); }
+#endif
+};
+
+#ifdef PMATH_SSE
+
+///////////////////////////////////////////////////////////////////////////////
+// x*x + y*y + z*z, added up in that order like the float version.
+inline float dot3( const pvec &_a, const pvec &_b ) {
+	__m128 m = _mm_mul_ps( _a.v, _b.v );
+	__m128 s = _mm_add_ss( m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)) );
+	return _mm_cvtss_f32( _mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2))) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// w comes out 0.
+inline pvec cross3( const pvec &_a, const pvec &_b ) {
+	__m128 a1 = _mm_shuffle_ps( _a.v, _a.v, _MM_SHUFFLE(3, 0, 2, 1) );
+	__m128 b1 = _mm_shuffle_ps( _b.v, _b.v, _MM_SHUFFLE(3, 1, 0, 2) );
+	__m128 a2 = _mm_shuffle_ps( _a.v, _a.v, _MM_SHUFFLE(3, 1, 0, 2) );
+	__m128 b2 = _mm_shuffle_ps( _b.v, _b.v, _MM_SHUFFLE(3, 0, 2, 1) );
+	__m128 c = _mm_sub_ps( _mm_mul_ps(a1, b1), _mm_mul_ps(a2, b2) );
+	// Clear w, it's a.w * b.w - a.w * b.w(0, unless it's inf or NaN).
+	return _mm_and_ps( c, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Absolute value of every component.
+inline pvec abs4( const pvec &_a ) {
+	return _mm_andnot_ps( _mm_set1_ps(-0.0f), _a.v );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Smallest/largest of each component.
+inline pvec min4( const pvec &_a, const pvec &_b ) { return _mm_min_ps( _a.v, _b.v ); }
+inline pvec max4( const pvec &_a, const pvec &_b ) { return _mm_max_ps( _a.v, _b.v ); }
+
+///////////////////////////////////////////////////////////////////////////////
+// True if any of x/y/z in _a is less than in _b. NaN's never are.
+inline bool anyless3( const pvec &_a, const pvec &_b ) {
+	return ( _mm_movemask_ps(_mm_cmplt_ps(_a.v, _b.v)) & 7 ) != 0;
+}
+
+#else
+
+inline float dot3( const pvec &_a, const pvec &_b ) {
+	return _a.v[0] * _b.v[0] + _a.v[1] * _b.v[1] + _a.v[2] * _b.v[2];
+}
+inline pvec cross3( const pvec &_a, const pvec &_b ) {
+	return pvec( _a.v[1] * _b.v[2] - _a.v[2] * _b.v[1],
+				 _a.v[2] * _b.v[0] - _a.v[0] * _b.v[2],
+				 _a.v[0] * _b.v[1] - _a.v[1] * _b.v[0] );
+}
+inline pvec abs4( const pvec &_a ) {
+	return pvec( fabs(_a.v[0]), fabs(_a.v[1]), fabs(_a.v[2]), fabs(_a.v[3]) );
+}
+inline pvec min4( const pvec &_a, const pvec &_b ) {
+	return pvec( _a.v[0] < _b.v[0] ? _a.v[0] : _b.v[0], _a.v[1] < _b.v[1] ? _a.v[1] : _b.v[1],
+				 _a.v[2] < _b.v[2] ? _a.v[2] : _b.v[2], _a.v[3] < _b.v[3] ? _a.v[3] : _b.v[3] );
+}
+inline pvec max4( const pvec &_a, const pvec &_b ) {
+	return pvec( _a.v[0] > _b.v[0] ? _a.v[0] : _b.v[0], _a.v[1] > _b.v[1] ? _a.v[1] : _b.v[1],
+				 _a.v[2] > _b.v[2] ? _a.v[2] : _b.v[2], _a.v[3] > _b.v[3] ? _a.v[3] : _b.v[3] );
+}
+inline bool anyless3( const pvec &_a, const pvec &_b ) {
+	return _a.v[0] < _b.v[0] || _a.v[1] < _b.v[1] || _a.v[2] < _b.v[2];
+}
+
+#endif // PMATH_SSE
+
+///////////////////////////////////////////////////////////////////////////////
+// Length of x/y/z.
+inline float length3( const pvec &_a ) {
+	return sqrtf( dot3(_a, _a) );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unit length, or all zeros if it has no length.
+inline pvec normalize3( const pvec &_a ) {
+	float len = length3( _a );
+	return ( len > 0.0f ) ? _a / len : pvec();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rotation/scale columns and translation. The bottom row of a mat4 is
+// always 0, 0, 0, 1 for a box, so it's left out.
+class pmat34 {
+	public:
+		// x/y/z axes(scaled), then translation.
+		pvec columns[4];
+
+		// Identity.
+		pmat34() {
+			columns[0] = pvec( 1, 0, 0, 0 );
+			columns[1] = pvec( 0, 1, 0, 0 );
+			columns[2] = pvec( 0, 0, 1, 0 );
+			columns[3] = pvec( 0, 0, 0, 1 );
+		}
+		explicit pmat34( const mat4 &_mat ) {
+			for( int c = 0; c < 4; c++ )
+				columns[c] = pvec( _mat.columns[c] );
+		}
+		mat4 tomat4( void ) const {
+			mat4 mat;
+			for( int c = 0; c < 4; c++ )
+				mat.columns[c] = columns[c].tovec3();
+			return mat;
+		}
+
+		// The point moved by the whole transform. w(1 for a point) scales the
+		// translation, like a mat4 product.
+		pvec transformpoint( const pvec &_pnt ) const {
+			return columns[0] * _pnt.x() + columns[1] * _pnt.y() + columns[2] * _pnt.z() + columns[3] * _pnt.w();
+		}
+		// Just rotated and scaled.
+		pvec transformvector( const pvec &_vec ) const {
+			return columns[0] * _vec.x() + columns[1] * _vec.y() + columns[2] * _vec.z();
+		}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Rotation quaternion, xyz in q's x/y/z and the real part in w.
+class pquat {
+	public:
+		pvec q;
+
+		// No rotation.
+		pquat(): q( 0, 0, 0, 1 ) {}
+		pquat( float _x, float _y, float _z, float _w ): q( _x, _y, _z, _w ) {}
+		// _axis has to be unit length. _angle is in degrees.
+		pquat( const pvec &_axis, float _angle ) {
+			_angle = ( _angle * 3.141592f ) / 180.0f;
+			float s = sin( _angle / 2 );
+			q = pvec( _axis.x() * s, _axis.y() * s, _axis.z() * s, cos(_angle / 2) );
+		}
+
+		// Axis(unit length) and angle(degrees) it rotates by.
+		void toaxisangle( pvec &_axis, float &_angle ) const {
+			float w = q.w();
+			_angle = ( (2 * acos( w )) * 180.0f ) / 3.141592f;
+			_axis = normalize3( q / sqrt(1 - w * w) );
+		}
+
+		// This rotation, then _o's first. Same as mat(this) * mat(_o).
+		pquat operator*( const pquat &_o ) const {
+			float ax = q.x(), ay = q.y(), az = q.z(), aw = q.w();
+			float bx = _o.q.x(), by = _o.q.y(), bz = _o.q.z(), bw = _o.q.w();
+			return pquat( aw * bx + ax * bw + ay * bz - az * by,
+						  aw * by - ax * bz + ay * bw + az * bx,
+						  aw * bz + ax * by - ay * bx + az * bw,
+						  aw * bw - ax * bx - ay * by - az * bz );
+		}
+
+		// _vec turned by this rotation.
+		pvec rotate( const pvec &_vec ) const {
+			pvec u( q.x(), q.y(), q.z() );
+			pvec t = cross3( u, _vec ) * 2.0f;
+			return _vec + t * q.w() + cross3( u, t );
+		}
+};
+
+#endif // PMATH_H
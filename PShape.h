@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PShape - Box Shapes(for PBox)
+//
+// Most scenes only have a few box sizes. Instead of every PBox keeping its
+// own copy of its corners, each one points at a shared PShape that never
+// changes...
+// * Width/height/depth and half sizes.
+// * The 8 untransformed corners.
+// * Bounding radius, the largest half size.
+// * Which corners make up the 12 lines and 6 faces. The same for every
+//   box, so those are just tables(PSHAPE_LINES, PSHAPE_FACES).
+//
+// pshapes.find() hands back the index of the shape for a size, adding it
+// the first time it's asked for. Shapes are never removed, so an index
+// stays good for the life of the program. Not thread safe, make boxes on
+// one thread.
+//
+// Usage:
+// int crate = pshapes.find( vec3(2, 1, 1) );
+// PBox box( vec3(0, 5, 0) );
+// box.setshape( crate );
+// float r = pshapes[box.shape].radius;
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PSHAPE_H
+#define PSHAPE_H
+
+// Lists of things.
+#include <vector>
+// fabs().
+#include <math.h>
+
+// vectors and such.
+#include "GLM_Lite.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Corners at each end of a box's 12 lines, and around each of its 6 faces.
+// Corners are numbered like PShape::corners.
+const int PSHAPE_LINES[12][2] = {
+	{0, 1}, {1, 2}, {2, 3}, {3, 4}, {4, 5}, {5, 6}, {6, 7},
+	{0, 5}, {1, 6}, {2, 7}, {0, 3}, {7, 4}
+};
+const int PSHAPE_FACES[6][4] = {
+	{0, 1, 2, 3}, {4, 7, 6, 5}, {5, 6, 1, 0},
+	{3, 2, 7, 4}, {1, 6, 7, 2}, {5, 0, 3, 4}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// One box size.
+class PShape {
+	public:
+		// Width/height/depth.
+		vec3 whd;
+		// Half of each.
+		vec3 half;
+		// Untransformed corners, centered on 0. Front face(-z) 0 to 3, back
+		// face(+z) 4 to 7.
+		vec3 corners[8];
+		// Largest half size. Times 2 and the box's scale, that's its
+		// largestaxis.
+		float radius;
+
+		PShape( const vec3 &_whd = vec3(1, 1, 1) ) {
+			whd = _whd;
+			half = vec3( _whd.x / 2, _whd.y / 2, _whd.z / 2 );
+			// Front Face.
+			corners[0] = vec3( -half.x, -half.y, -half.z );
+			corners[1] = vec3( -half.x,  half.y, -half.z );
+			corners[2] = vec3(  half.x,  half.y, -half.z );
+			corners[3] = vec3(  half.x, -half.y, -half.z );
+			// Back Face.
+			corners[4] = vec3(  half.x, -half.y, half.z );
+			corners[5] = vec3( -half.x, -half.y, half.z );
+			corners[6] = vec3( -half.x,  half.y, half.z );
+			corners[7] = vec3(  half.x,  half.y, half.z );
+			radius = fabs( half.x );
+			radius = ( fabs(half.y) > radius ) ? fabs( half.y ) : radius;
+			radius = ( fabs(half.z) > radius ) ? fabs( half.z ) : radius;
+		}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Every shape boxes have been made with.
+class PShapes {
+	public:
+		///////////////////////////////////////////////////////////////////////
+		// Index of the shape _whd in size, added if it's new. Just a walk over
+		// the shapes so far, there are never many.
+		int find( const vec3 &_whd ) {
+			int numshapes = shapes.size();
+			for( int s = 0; s < numshapes; s++ )
+				if( shapes[s].whd.x == _whd.x && shapes[s].whd.y == _whd.y && shapes[s].whd.z == _whd.z )
+					return s;
+			shapes.push_back( PShape(_whd) );
+			return numshapes;
+		}
+
+		const PShape &operator[]( int _shape ) const { return shapes[_shape]; }
+		int size( void ) const { return shapes.size(); }
+
+	private:
+		std::vector <PShape> shapes;
+};
+
+// Shared by every box.
+PShapes pshapes;
+
+#endif // PSHAPE_H
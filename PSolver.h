@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PSolver - Contact Solver Data(for PBox)
+//
+// The settings and per step constraints for PBox's sequential impulse
+// contact solver...
+// * Solver and position correction modes.
+// * One PSolverContact per touching pair(or box/ground), holding a normal,
+//   two friction directions and a range of PSolverPoints.
+// * Accumulated impulses per point, so every iteration only adds the
+//   difference. Last step's impulses are matched to this step's points
+//   and applied up front(warm starting), so stacks don't have to be
+//   re-solved from nothing every step.
+// * Optional color batches(pworld.colorbatches), contacts that share no
+//   moving box, so a big pile's contacts can be solved on every thread.
+//
+// The solving itself lives in PBox(see PBox::solvecontacts()), next to
+// fixpenetration()/reaction().
+//
+// Usage:
+// pworld.solver = PSOLVER_IMPULSE;
+// pworld.iterations = 10;
+// pworld.correction = PCORRECT_SPLIT;
+// PBox::update( pboxes, 10 );
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PSOLVER_H
+#define PSOLVER_H
+
+// vectors and such.
+#include "GLM_Lite.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// How update() responds to contacts.
+enum {
+	// fixpenetration()/reaction() per contact, as they're found. The original
+	// behaviour.
+	PSOLVER_NUDGE = 0,
+	// Gather every contact, then solve them all together with sequential
+	// impulses on vel/angvel.
+	PSOLVER_IMPULSE
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// How the impulse solver gets boxes back out of each other.
+enum {
+	// Feed some of the penetration back in as extra velocity. Cheap, but the
+	// extra velocity stays, so stacks can bounce a little.
+	PCORRECT_BAUMGARTE = 0,
+	// Solve the penetration separately with throwaway velocities that only
+	// move the boxes for this step. Nothing bounces.
+	PCORRECT_SPLIT
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// One contact point of a PSolverContact.
+struct PSolverPoint {
+	// Point relative to each box's center.
+	vec3 ra;
+	vec3 rb;
+	// ra in box a's own(unrotated) frame. Used to find the same point
+	// next step.
+	vec3 local;
+	// 1 / effective mass along the normal and along each tangent.
+	float normalmass;
+	float tangentmass[2];
+	// Impulses applied so far this step.
+	float normalimpulse;
+	float tangentimpulse[2];
+	// Same, for the split impulse position pass.
+	float splitimpulse;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Every contact point between two boxes, or a box and the ground.
+struct PSolverContact {
+	// Boxes. b is -1 for ground.
+	int a;
+	int b;
+	// Pair id(see PPair). Ground contacts use a and the ground's index
+	// instead. Same boxes, same id, every step.
+	unsigned long long id;
+	// Points from b toward a. Pushing a along it separates the two.
+	vec3 normal;
+	// Friction directions, both perpendicular to normal.
+	vec3 tangents[2];
+	// Friction coefficient.
+	float friction;
+	// How far the two overlap along normal.
+	float depth;
+	// Separating velocity we ask for to fix depth.
+	float bias;
+	// Range in the world's solver point list.
+	int firstpoint;
+	int numpoints;
+	// Color batch(see PBox::colorcontacts()).
+	int color;
+};
+
+#endif // PSOLVER_H
@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PStats - Step Statistics(for PBox)
+//
+// Where does PBox::update() spend its time? Define PBOX_STATS before
+// including PBox.h and every step fills pworld.stats with...
+// * High resolution timings(milliseconds) for each phase of the step.
+// * Counters for the collision and octree work that was done.
+//
+// Without PBOX_STATS the PSTATS_ macros below expand to nothing, so the
+// step pays nothing for them. The struct itself is still there(all zeros)
+// so code reading it doesn't need #ifdef's.
+//
+// Usage:
+// #define PBOX_STATS
+// #include "PBox.h"
+// PBox::update( pboxes, 10 );
+// double ms = pworld.stats.narrowphase;
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PSTATS_H
+#define PSTATS_H
+
+#ifdef PBOX_STATS
+// High resolution clock.
+#include <chrono>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Numbers for one step. Times are in milliseconds.
+struct PStepStats {
+	// Velocity/position updates.
+	double integrate;
+	// Adding/refreshing spheres, building and resetting the octree.
+	double treerefresh;
+	// SpocTree::getbucket() lookups.
+	double getbucket;
+	// collision() calls.
+	double narrowphase;
+	// fixpenetration() calls(impulse solver: position correction).
+	double penetration;
+	// reaction() calls(impulse solver: velocity iterations).
+	double reaction;
+	// The whole update().
+	double total;
+
+	// collision() calls that quit at the sphere distance check.
+	unsigned int sphereearlyouts;
+	// Pairs PBox::rejectpairs() threw out at the box or separating axis
+	// checks(the ones it threw out at the sphere check are counted above).
+	unsigned int satearlyouts;
+	// Pairs thrown out on last step's separating axis, or with no checks at
+	// all because neither box moved.
+	unsigned int axiscachehits;
+	// Pairs left out because of their boxes' layers or group(see
+	// PBox::canhit()).
+	unsigned int layerskips;
+	// collision() calls that went on to the full edge/face tests.
+	unsigned int edgefacetests;
+	// Contact points kept, after reducing to 4 per collision.
+	unsigned int contactpoints;
+	// Octree nodes visited while placing spheres and finding buckets.
+	unsigned int nodesvisited;
+	// Heap allocations during the step(see PArena.h). 0 once the arenas
+	// have grown to fit the scene.
+	unsigned int heapallocs;
+
+	// Def C-tor.
+	PStepStats() { clear(); }
+
+	// Zeroes everything.
+	void clear( void ) {
+		integrate = treerefresh = getbucket = 0.0;
+		narrowphase = penetration = reaction = total = 0.0;
+		sphereearlyouts = satearlyouts = axiscachehits = layerskips = edgefacetests = contactpoints = nodesvisited = heapallocs = 0;
+	}
+
+	// Adds another step's numbers. Useful for totals over a frame.
+	PStepStats &operator+=( const PStepStats &_stats ) {
+		integrate += _stats.integrate;
+		treerefresh += _stats.treerefresh;
+		getbucket += _stats.getbucket;
+		narrowphase += _stats.narrowphase;
+		penetration += _stats.penetration;
+		reaction += _stats.reaction;
+		total += _stats.total;
+		sphereearlyouts += _stats.sphereearlyouts;
+		satearlyouts += _stats.satearlyouts;
+		axiscachehits += _stats.axiscachehits;
+		layerskips += _stats.layerskips;
+		edgefacetests += _stats.edgefacetests;
+		contactpoints += _stats.contactpoints;
+		nodesvisited += _stats.nodesvisited;
+		heapallocs += _stats.heapallocs;
+		return *this;
+	}
+};
+
+#ifdef PBOX_STATS
+
+///////////////////////////////////////////////////////////////////////////////
+// Stopwatch. begin() and then elapsed() for milliseconds since.
+struct PTimer {
+	std::chrono::high_resolution_clock::time_point start;
+	void begin( void ) { start = std::chrono::high_resolution_clock::now(); }
+	double elapsed( void ) const {
+		return std::chrono::duration<double, std::milli>(
+			std::chrono::high_resolution_clock::now() - start ).count();
+	}
+};
+
+// Starts a named timer.
+#define PSTATS_BEGIN( _timer ) PTimer _timer; _timer.begin()
+// Adds a timer's elapsed time to a stats field.
+#define PSTATS_END( _timer, _field ) ( _field ) += _timer.elapsed()
+// Adds to a counter.
+#define PSTATS_ADD( _field, _num ) ( _field ) += ( _num )
+// Sets a counter or field.
+#define PSTATS_SET( _field, _val ) ( _field ) = ( _val )
+
+#else
+
+// Nothing runs, but the fields are still named(sizeof doesn't evaluate),
+// so stats-only parameters count as used and typos still fail to build.
+#define PSTATS_BEGIN( _timer ) ((void)0)
+#define PSTATS_END( _timer, _field ) ((void)sizeof( _field ))
+#define PSTATS_ADD( _field, _num ) ((void)sizeof( ( _field ) += ( _num ) ))
+#define PSTATS_SET( _field, _val ) ((void)sizeof( ( _field ) = ( _val ) ))
+
+#endif // PBOX_STATS
+
+#endif // PSTATS_H
@@ -0,0 +1,282 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PTrace - Step Trace Recorder(for PBox)
+//
+// Records what PBox::update() is doing, and when, as Chrome/Perfetto
+// trace-event JSON. Load the file in chrome://tracing or ui.perfetto.dev
+// to see every step's phases and narrowphase pairs on a timeline.
+//
+// * Define PBOX_TRACE before including PBox.h. Without it the PTRACE_
+//   macros below expand to nothing.
+// * Every thread that records gets its own ring buffer(allocated the first
+//   time that thread records). Recording an event is a couple of stores
+//   and an atomic store. No locks, no allocations, so it doesn't skew the
+//   timings it's measuring.
+// * If a ring fills up before flush() drains it, new events are dropped
+//   and counted(see dropped()) instead of blocking.
+//
+// Usage:
+// #define PBOX_TRACE
+// #include "PBox.h"
+// ptrace.start( "pbox.json" );
+// for( ... ) { PBox::update( pboxes, 10 ); ptrace.flush(); }
+// ptrace.stop();
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PTRACE_H
+#define PTRACE_H
+
+#ifdef PBOX_TRACE
+
+// fopen()/fprintf().
+#include <stdio.h>
+// Lock free ring indices.
+#include <atomic>
+// Timestamps.
+#include <chrono>
+
+// Events per thread ring. Must be a power of 2.
+#ifndef PTRACE_RING_SIZE
+#define PTRACE_RING_SIZE 65536
+#endif
+
+// Max number of threads that can record.
+#ifndef PTRACE_MAX_THREADS
+#define PTRACE_MAX_THREADS 64
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// One complete("X") event. name must be a string literal, we only keep the
+// pointer. a/b are optional arguments, -1 if unused.
+struct PTraceEvent {
+	const char *name;
+	// Start and duration in nanoseconds since the recorder's epoch.
+	long long ts;
+	long long dur;
+	int a;
+	int b;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Single producer/single consumer ring.
+// The owning thread push()es, flush() is the only reader.
+struct PTraceRing {
+	PTraceEvent events[PTRACE_RING_SIZE];
+	// Next slot to write. Only the owner stores to it.
+	std::atomic <unsigned int> head;
+	// Next slot to read. Only the reader stores to it.
+	std::atomic <unsigned int> tail;
+	// Events that didn't fit.
+	std::atomic <unsigned int> dropped;
+	// Thread id used in the trace.
+	int tid;
+
+	PTraceRing( int _tid ): head(0), tail(0), dropped(0), tid(_tid) {}
+
+	// Owner thread only.
+	void push( const PTraceEvent &_event ) {
+		unsigned int h = head.load( std::memory_order_relaxed );
+		unsigned int t = tail.load( std::memory_order_acquire );
+		if( h - t >= PTRACE_RING_SIZE ) {
+			dropped.fetch_add( 1, std::memory_order_relaxed );
+			return;
+		}
+		events[ h & (PTRACE_RING_SIZE - 1) ] = _event;
+		head.store( h + 1, std::memory_order_release );
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The recorder. PBox.h makes one, ptrace.
+class PTrace {
+	public:
+
+		// True between start() and stop(). Checked by every event.
+		std::atomic <bool> recording;
+
+		// Rings, one per thread that has recorded something.
+		std::atomic <PTraceRing *> rings[PTRACE_MAX_THREADS];
+		std::atomic <int> numrings;
+
+		// Output file and whether we've written an event to it yet(for commas).
+		FILE *file;
+		bool wroteevent;
+
+		// Timestamps are relative to this.
+		std::chrono::steady_clock::time_point epoch;
+
+		///////////////////////////////////////////////////////////////////////
+		// Def C-Tor.
+		PTrace(): recording(false), numrings(0), file(0), wroteevent(false) {
+			for( int r = 0; r < PTRACE_MAX_THREADS; r++ )
+				rings[r].store( 0 );
+			epoch = std::chrono::steady_clock::now();
+		}
+		///////////////////////////////////////////////////////////////////////
+		// Def Destructor.
+		~PTrace() {
+			stop();
+			for( int r = 0; r < PTRACE_MAX_THREADS; r++ )
+				delete rings[r].load();
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Nanoseconds since epoch.
+		long long now( void ) const {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - epoch ).count();
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Opens the output file and starts recording.
+		// Returns false if the file couldn't be opened.
+		bool start( const char *_filename ) {
+			stop();
+			file = fopen( _filename, "w" );
+			if( !file ) return false;
+			fprintf( file, "{\"traceEvents\":[\n" );
+			wroteevent = false;
+			// Forget anything recorded while we weren't listening.
+			int nrings = numrings.load( std::memory_order_acquire );
+			for( int r = 0; r < nrings; r++ ) {
+				PTraceRing *ring = rings[r].load( std::memory_order_acquire );
+				if( ring )
+					ring->tail.store( ring->head.load(std::memory_order_acquire), std::memory_order_release );
+			}
+			recording.store( true, std::memory_order_release );
+			return true;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Stops recording, writes what's left and closes the file.
+		void stop( void ) {
+			if( !file ) return;
+			recording.store( false, std::memory_order_release );
+			flush();
+			// Name the threads so the timeline reads nicely.
+			int nrings = numrings.load( std::memory_order_acquire );
+			for( int r = 0; r < nrings; r++ ) {
+				PTraceRing *ring = rings[r].load( std::memory_order_acquire );
+				if( !ring ) continue;
+				fprintf( file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+							   "\"args\":{\"name\":\"pbox %d\"}}", wroteevent ? ",\n" : "",
+						 ring->tid, ring->tid );
+				wroteevent = true;
+			}
+			fprintf( file, "\n]}\n" );
+			fclose( file );
+			file = 0;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Drains every ring into the file. Call from one thread only, between
+		// steps or from a background thread.
+		void flush( void ) {
+			if( !file ) return;
+			int nrings = numrings.load( std::memory_order_acquire );
+			for( int r = 0; r < nrings; r++ ) {
+				PTraceRing *ring = rings[r].load( std::memory_order_acquire );
+				if( !ring ) continue;
+				unsigned int t = ring->tail.load( std::memory_order_relaxed );
+				unsigned int h = ring->head.load( std::memory_order_acquire );
+				for( ; t != h; t++ )
+					writeevent( ring->events[ t & (PTRACE_RING_SIZE - 1) ], ring->tid );
+				ring->tail.store( t, std::memory_order_release );
+			}
+			fflush( file );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Events lost to full rings, all threads.
+		unsigned int dropped( void ) {
+			unsigned int total = 0;
+			int nrings = numrings.load( std::memory_order_acquire );
+			for( int r = 0; r < nrings; r++ ) {
+				PTraceRing *ring = rings[r].load( std::memory_order_acquire );
+				if( ring )
+					total += ring->dropped.load( std::memory_order_relaxed );
+			}
+			return total;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// The calling thread's ring. Made the first time a thread records.
+		// Returns 0 if we're out of slots.
+		PTraceRing *threadring( void ) {
+			static thread_local PTraceRing *ring = 0;
+			if( !ring ) {
+				int slot = numrings.load( std::memory_order_relaxed );
+				while( slot < PTRACE_MAX_THREADS &&
+					   !numrings.compare_exchange_weak(slot, slot + 1, std::memory_order_acq_rel) ) {}
+				if( slot >= PTRACE_MAX_THREADS ) return 0;
+				ring = new PTraceRing( slot );
+				// Readers skip empty slots until this lands.
+				rings[slot].store( ring, std::memory_order_release );
+			}
+			return ring;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Records a finished event for the calling thread.
+		void record( const char *_name, long long _ts, long long _dur, int _a = -1, int _b = -1 ) {
+			PTraceRing *ring = threadring();
+			if( !ring ) return;
+			PTraceEvent ev;
+			ev.name = _name;
+			ev.ts = _ts;
+			ev.dur = _dur;
+			ev.a = _a;
+			ev.b = _b;
+			ring->push( ev );
+		}
+
+	private:
+
+		///////////////////////////////////////////////////////////////////////
+		// One event as JSON. Timestamps are in microseconds.
+		void writeevent( const PTraceEvent &_ev, int _tid ) {
+			fprintf( file, "%s{\"name\":\"%s\",\"cat\":\"pbox\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+						   "\"ts\":%.3f,\"dur\":%.3f", wroteevent ? ",\n" : "", _ev.name, _tid,
+					 _ev.ts / 1000.0, _ev.dur / 1000.0 );
+			if( _ev.a >= 0 )
+				fprintf( file, ",\"args\":{\"a\":%d,\"b\":%d}", _ev.a, _ev.b );
+			fprintf( file, "}" );
+			wroteevent = true;
+		}
+};
+
+// PBoxes record into this.
+PTrace ptrace;
+
+///////////////////////////////////////////////////////////////////////////////
+// Records a complete event for the scope it lives in.
+struct PTraceScope {
+	const char *name;
+	long long start;
+	int a;
+	int b;
+	PTraceScope( const char *_name, int _a = -1, int _b = -1 ): name(_name), start(-1), a(_a), b(_b) {
+		if( ptrace.recording.load(std::memory_order_relaxed) )
+			start = ptrace.now();
+	}
+	~PTraceScope() {
+		if( start >= 0 )
+			ptrace.record( name, start, ptrace.now() - start, a, b );
+	}
+};
+
+#define PTRACE_CAT2( _x, _y ) _x##_y
+#define PTRACE_CAT( _x, _y ) PTRACE_CAT2( _x, _y )
+// Records the rest of the current scope as _name.
+#define PTRACE_SCOPE( _name ) PTraceScope PTRACE_CAT( ptscope, __LINE__ )( _name )
+// Same, tagged with a pair of box indices.
+#define PTRACE_SCOPE_PAIR( _name, _a, _b ) PTraceScope PTRACE_CAT( ptscope, __LINE__ )( _name, _a, _b )
+
+#else
+
+#define PTRACE_SCOPE( _name )
+#define PTRACE_SCOPE_PAIR( _name, _a, _b )
+
+#endif // PBOX_TRACE
+
+#endif // PTRACE_H
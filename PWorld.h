@@ -0,0 +1,697 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PWorld - Physics World(for PBox)
+//
+// Holds the settings and scratch data PBox::update() needs between
+// steps...
+// * Step settings, like deterministic mode.
+// * The octree for dynamic boxes.
+// * Broadphase pair list.
+// * Contacts gathered for those pairs.
+// * Static(non-dynamic) boxes and their own octree.
+// * Ground planes and heightfields.
+// * Contact solver settings and constraints(see PSolver.h).
+// * Step statistics(see PStats.h).
+// * Two frame arenas(see PArena.h) every per step list lives in.
+// * Worker threads(see PJobs.h), and a lane of scratch for each.
+// * Boxes renamed by swap-removes and sorts since the last step(see
+//   removebox()/reorderboxes()), so last step's contacts and separating
+//   axes follow their boxes.
+// * Contact events, which pairs started, kept or stopped touching this
+//   step(see events).
+//
+// PBox.h creates one for you, pworld, and PBox::update() uses it unless
+// it's handed another(see PWorlds.h).
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PWORLD_H
+#define PWORLD_H
+
+// Lists of things.
+#include <vector>
+#include <deque>
+// Sorting pairs.
+#include <algorithm>
+
+// Contact points for pairs.
+#include "PCollision.h"
+// Octree for static boxes.
+#include "SpocTree.h"
+// Planes and heightfields.
+#include "PGround.h"
+// Per step timings and counters.
+#include "PStats.h"
+// Impulse solver settings and constraints.
+#include "PSolver.h"
+// Per step scratch memory.
+#include "PArena.h"
+// Worker threads.
+#include "PJobs.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Two boxes the broadphase says might be touching.
+// a is always the smaller index.
+struct PPair {
+	int a;
+	int b;
+	// Dummy default constructor.
+	PPair() {}
+	// Stores the indices smallest first.
+	PPair( int _i1, int _i2 ) {
+		a = ( _i1 < _i2 ) ? _i1 : _i2;
+		b = ( _i1 < _i2 ) ? _i2 : _i1;
+	}
+	// Pair id. Unique for every pair and sorts by a, then b.
+	unsigned long long id( void ) const {
+		return ( (unsigned long long)(unsigned int)a << 32 ) | (unsigned int)b;
+	}
+	// Lets std::sort() put pairs in canonical order.
+	bool operator<( const PPair &_pair ) const { return id() < _pair.id(); }
+	bool operator==( const PPair &_pair ) const { return id() == _pair.id(); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Separating axis(PAXIS_) a pair was thrown out on, by pair id.
+struct PPairAxis {
+	unsigned long long id;
+	int axis;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Contacts for one side of a pair.
+// box is the box that owns the points(the CALLING box in collision()).
+// other is the box it hit, or -1 - g for ground g(planes first, then
+// heightfields).
+// The points themselves are in PWorld::contactpoints.
+struct PPairContact {
+	int box;
+	int other;
+	// Range in contactpoints.
+	int firstpoint;
+	int numpoints;
+	// One-face normals(see PCollision::averagenormals1f()).
+	vec3 box1norm;
+	vec3 box2norm;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// What happened to a pair this step.
+enum {
+	// Touching now, not last step.
+	PCONTACT_BEGIN = 0,
+	// Touching now and last step.
+	PCONTACT_PERSIST,
+	// Touched last step, not now.
+	PCONTACT_END
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// One pair's contact event(see PWorld::events). Also what PWorld::touching
+// keeps for every pair touching this step.
+struct PContactEvent {
+	// PCONTACT_.
+	int type;
+	// Boxes, a the smaller index. b is -1 - g for ground g, like
+	// PPairContact::other.
+	int a;
+	int b;
+	// Same pair, same id, every step(see PWorld::contactid()).
+	unsigned long long id;
+	// Box the points were found on. a, unless only b reported the pair.
+	int box;
+	// Points found this step and the middle of them. Ends have no points
+	// and last step's middle.
+	int numpoints;
+	vec3 point;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Where one pair's(or one box's ground) contacts went. Range in a lane's
+// contacts.
+struct PContactRange {
+	int lane;
+	int first;
+	int num;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// One thread's scratch while the step's jobs run(see PJobs.h). The
+// narrowphase stores contacts here, PWorld::takecontacts() gathers them up
+// in pair order afterwards.
+struct PLane {
+	PArena arena;
+	PArenaArray <PPairContact> contacts;
+	PArenaArray <PCPoint> points;
+	// Counters and narrowphase time for this thread. Added to
+	// pworld.stats at the end of the step.
+	PStepStats stats;
+
+	PLane() { reset(); }
+
+	// Empties everything for a new step.
+	void reset( void ) {
+		arena.reset();
+		contacts.setarena( &arena );
+		points.setarena( &arena );
+		stats.clear();
+	}
+
+	// Stores _pc's points as a contact between _box and _other. Nothing
+	// is stored if there aren't any.
+	void addcontact( int _box, int _other, const PCollision &_pc ) {
+		if( _pc.numcolpnts == 0 )
+			return;
+		PPairContact ppc;
+		ppc.box = _box;
+		ppc.other = _other;
+		ppc.firstpoint = points.size();
+		ppc.numpoints = _pc.numcolpnts;
+		ppc.box1norm = _pc.box1norm;
+		ppc.box2norm = _pc.box2norm;
+		points.append( _pc.colpnts, _pc.numcolpnts );
+		contacts.push_back( ppc );
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// World settings and per step scratch.
+class PWorld {
+	public:
+
+		// Deterministic mode.
+		// When false(default), update() reacts to contacts while it walks the
+		// octree buckets, so the result depends on box and bucket order.
+		// When true, update() collects every pair first, sorts them by pair id
+		// and runs collision() for both sides of every pair against the same,
+		// untouched, box state. Responses are then applied in pair order.
+		// Same inputs give the same transforms, no matter the bucket order or
+		// how the narrowphase is split up.
+		bool deterministic;
+
+		// Worker threads. Just the calling thread until setthreads().
+		PJobs jobs;
+		// Scratch for every thread, indexed by PJobs::lane().
+		std::deque <PLane> lanes;
+
+		// Scratch memory for one step. frame is the one this step uses,
+		// the other still holds last step's constraints. nextstep() swaps.
+		PArena frames[2];
+		int frame;
+
+		// Broadphase pairs for this step. Canonical order in deterministic
+		// mode.
+		PArenaArray <PPair> pairs;
+
+		// Throw out clearly separated pairs 8 at a time, before any
+		// collision() calls(see PBox::rejectpairs()). On by default, it only
+		// drops pairs collision() would find nothing for.
+		bool batchreject;
+		// Every box as a PBoxOBB, this step's and last step's(in the other
+		// frame), and 1 for every box that hasn't moved since.
+		PArenaArray <PBoxOBB> obbs;
+		PArenaArray <PBoxOBB> lastobbs;
+		PArenaArray <unsigned char> still;
+		// Separating axis for every pair in pairs, PAXIS_NONE if it's kept.
+		PArenaArray <unsigned char> pairaxes;
+		// Pairs thrown out this step and last, sorted by pair id.
+		PArenaArray <PPairAxis> sepaxes;
+		PArenaArray <PPairAxis> lastsepaxes;
+
+		// Contacts found for pairs. Only sides that have points are stored,
+		// and always in pair order.
+		PArenaArray <PPairContact> contacts;
+		// Where the narrowphase put each pair's contacts, and each box's
+		// ground contacts. takecontacts() copies them into contacts.
+		PArenaArray <PContactRange> pairranges;
+		PArenaArray <PContactRange> groundranges;
+
+		// Points for every contact above, back to back.
+		PArenaArray <PCPoint> contactpoints;
+
+		// Work out contact events every step. On by default.
+		bool contactevents;
+		// Every pair that began, kept or ended touching in the last update(),
+		// in contact id order. Good until the next one.
+		PArenaArray <PContactEvent> events;
+		// Pairs touching this step and last, by contact id. No duplicates
+		// once buildevents() is done.
+		PArenaArray <PContactEvent> touching;
+		PArenaArray <PContactEvent> lasttouching;
+
+		// Timings and counters for the last step. Filled only when
+		// PBOX_STATS is defined.
+		PStepStats stats;
+
+		// Octree for dynamic boxes, sptree to PBox. update() builds it when
+		// it's empty and refills it every step.
+		SpocTree tree;
+
+		// Static boxes don't move, so they get their own octree. It's built
+		// with sptree(whenever sptree is empty) and never refreshed. Only
+		// dynamic boxes look things up in it.
+		// Changed which boxes are static, or moved one? sptree.clear() and
+		// the next update() rebuilds both.
+		SpocTree statictree;
+		// Box index for every sphere in statictree.
+		std::vector <int> staticboxes;
+		// Lines/faces/normals for every static box, same order as staticboxes.
+		std::vector <PBoxGeom> staticgeoms;
+		// Index into staticboxes/staticgeoms for every box, -1 if dynamic.
+		std::vector <int> staticslots;
+		// Scratch for statictree.query().
+		PArenaArray <int> found;
+		// Dynamic boxes update() puts in sptree this step.
+		PArenaArray <int> movers;
+
+		// Boxes in the last update().
+		int numboxes;
+		// Swap-removes and sorts since then(see removebox() and
+		// reorderboxes()). Index each box had last step(-1 if it's new), and
+		// where each of last step's boxes is now(-1 if it's gone). Both
+		// empty if nothing moved.
+		std::vector <int> oldindex;
+		std::vector <int> newindex;
+
+		// Ground. Every dynamic box is checked against all of these every
+		// step, no octree. Keep the list short.
+		std::vector <PPlane> planes;
+		std::vector <PHeightfield> heightfields;
+
+		// Contact solver, PSOLVER_NUDGE(default) or PSOLVER_IMPULSE.
+		// The impulse solver always gathers and sorts pairs first, like
+		// deterministic mode, and ignores the deterministic flag.
+		int solver;
+		// Impulse solver passes over every contact per step. More is
+		// stiffer and slower.
+		int iterations;
+		// PCORRECT_BAUMGARTE or PCORRECT_SPLIT.
+		int correction;
+		// Fraction of the penetration fixed per step.
+		float baumgarte;
+		// Penetration we leave alone, so resting boxes stay in contact.
+		float slop;
+		// Most we push boxes apart per step to fix penetration.
+		float maxcorrection;
+		// Friction coefficient for every contact.
+		float friction;
+		// Start every point off with last step's impulses. Much stiffer
+		// stacks for the same number of iterations.
+		bool warmstart;
+		// Solve contacts in color batches, each batch spread over every
+		// thread(see PBox::colorcontacts()). Solves them in a different
+		// order than contact order, so results aren't the same as with it
+		// off, but they're the same for any number of threads.
+		bool colorbatches;
+
+		// Impulse solver constraints for this step, in contact order.
+		PArenaArray <PSolverContact> solvercontacts;
+		PArenaArray <PSolverPoint> solverpoints;
+		// Last step's constraints, for warm starting, and their ids sorted
+		// with their index. Live in the other frame.
+		PArenaArray <PSolverContact> lastcontacts;
+		PArenaArray <PSolverPoint> lastpoints;
+		PArenaArray < std::pair<unsigned long long, int> > lastids;
+		// Split impulse velocities, one per box. Thrown away every step.
+		PArenaArray <vec3> splitvel;
+		PArenaArray <vec3> splitangvel;
+		// Contact indices grouped into batches(by color, or by box for the
+		// deterministic responses), and where each batch starts. One more
+		// start than there are batches.
+		PArenaArray <int> batchorder;
+		PArenaArray <int> batchstarts;
+		// Colors each box already has, one bit each.
+		PArenaArray <unsigned long long> colormasks;
+
+		///////////////////////////////////////////////////////////////////////
+		// Def C-Tor.
+		PWorld(): deterministic(false), batchreject(true), contactevents(true), solver(PSOLVER_NUDGE), iterations(10),
+				  correction(PCORRECT_SPLIT), baumgarte(0.2f), slop(0.005f), maxcorrection(0.02f),
+				  friction(0.5f), warmstart(true), colorbatches(false) {
+			numboxes = 0;
+			frame = 0;
+			newframe();
+			lastcontacts.setarena( &frames[frame] );
+			lastpoints.setarena( &frames[frame] );
+			lastobbs.setarena( &frames[frame] );
+			lastsepaxes.setarena( &frames[frame] );
+			lasttouching.setarena( &frames[frame] );
+			tree.jobs = &jobs;
+			// Built once, so keeping layers costs nothing per step.
+			statictree.layered = true;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Adds a pair. Duplicates are fine, sortpairs() removes them.
+		void addpair( int _i1, int _i2 ) {
+			pairs.push_back( PPair(_i1, _i2) );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Puts pairs in canonical(pair id) order and drops duplicates.
+		void sortpairs( void ) {
+			std::sort( pairs.begin(), pairs.end() );
+			pairs.resize( std::unique(pairs.begin(), pairs.end()) - pairs.begin() );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Id for contacts between box _box and _other(-1 - g for ground g).
+		// The pair id for two boxes. Ground uses _box and the ground's index,
+		// high bit set so it can't look like a box.
+		static unsigned long long contactid( int _box, int _other ) {
+			if( _other >= 0 )
+				return PPair( _box, _other ).id();
+			return ( (unsigned long long)(unsigned int)_box << 32 ) | (unsigned int)( 0x80000000 - 1 - _other );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// _box is touching _other(-1 - g for ground g) at _numpoints points.
+		// For buildevents(), the same pair can come in more than once.
+		void touch( int _box, int _other, const PCPoint *_pnts, int _numpoints ) {
+			PContactEvent touch;
+			touch.a = _box;
+			touch.b = _other;
+			if( _other >= 0 && _other < _box ) {
+				touch.a = _other;
+				touch.b = _box;
+			}
+			touch.id = contactid( _box, _other );
+			touch.box = _box;
+			touch.numpoints = _numpoints;
+			touch.point = vec3( 0, 0, 0 );
+			for( int p = 0; p < _numpoints; p++ )
+				touch.point = touch.point + _pnts[p].pnt;
+			if( _numpoints > 0 )
+				touch.point = touch.point / (float)_numpoints;
+			touching.push_back( touch );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Fills events from touching and lasttouching. The gathering paths
+		// leave their contacts in contacts, so they're added here. The
+		// nudging path touch()es as it goes.
+		void buildevents( void ) {
+			for( int c = 0; c < contacts.size(); c++ )
+				touch( contacts[c].box, contacts[c].other, &contactpoints[ contacts[c].firstpoint ],
+					   contacts[c].numpoints );
+			// Both sides of a pair can touch(). Ties sort by box, so a's
+			// points are the ones kept when it reported the pair too.
+			std::sort( touching.begin(), touching.end(), sortevents );
+			int kept = 0;
+			for( int t = 0; t < touching.size(); t++ )
+				if( kept == 0 || touching[kept - 1].id != touching[t].id )
+					touching[ kept++ ] = touching[t];
+			touching.resize( kept );
+
+			// Walk both in id order.
+			int now = 0;
+			int last = 0;
+			while( now < touching.size() || last < lasttouching.size() ) {
+				PContactEvent event;
+				if( last == lasttouching.size() ||
+					( now < touching.size() && touching[now].id < lasttouching[last].id ) ) {
+					event = touching[ now++ ];
+					event.type = PCONTACT_BEGIN;
+				}
+				else if( now == touching.size() || lasttouching[last].id < touching[now].id ) {
+					event = lasttouching[ last++ ];
+					event.type = PCONTACT_END;
+					event.numpoints = 0;
+				}
+				else {
+					event = touching[ now++ ];
+					event.type = PCONTACT_PERSIST;
+					last++;
+				}
+				events.push_back( event );
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Contact id order for std::sort().
+		static bool sortevents( const PContactEvent &_a, const PContactEvent &_b ) {
+			return ( _a.id != _b.id ) ? ( _a.id < _b.id ) : ( _a.box < _b.box );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// The calling thread's lane.
+		PLane &lane( void ) { return lanes[ PJobs::lane() ]; }
+
+		///////////////////////////////////////////////////////////////////////
+		// Copies every pair's contacts, then every box's ground contacts, out
+		// of the lanes and into contacts/contactpoints. Same order the
+		// narrowphase would have stored them on one thread.
+		void takecontacts( void ) {
+			takecontacts( pairranges );
+			takecontacts( groundranges );
+		}
+
+		void takecontacts( const PArenaArray <PContactRange> &_ranges ) {
+			for( int r = 0; r < _ranges.size(); r++ ) {
+				const PContactRange &range = _ranges[r];
+				const PLane &from = lanes[ range.lane ];
+				for( int c = range.first; c < range.first + range.num; c++ ) {
+					PPairContact ppc = from.contacts[c];
+					ppc.firstpoint = contactpoints.size();
+					contactpoints.append( &from.points[ from.contacts[c].firstpoint ], ppc.numpoints );
+					contacts.push_back( ppc );
+				}
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Copies contact _c back into a PCollision, for respond() and
+		// friends.
+		void getcontact( int _c, PCollision &_pc ) const {
+			const PPairContact &ppc = contacts[_c];
+			_pc.numcolpnts = ppc.numpoints;
+			for( int p = 0; p < ppc.numpoints; p++ )
+				_pc.colpnts[p] = contactpoints[ ppc.firstpoint + p ];
+			_pc.box1norm = ppc.box1norm;
+			_pc.box2norm = ppc.box2norm;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Switches to the other frame arena and empties it, and every list
+		// living in it. Whatever is in the current one stays valid for one
+		// more step.
+		void newframe( void ) {
+			frame ^= 1;
+			PArena *arena = &frames[frame];
+			arena->reset();
+			pairs.setarena( arena );
+			obbs.setarena( arena );
+			still.setarena( arena );
+			pairaxes.setarena( arena );
+			sepaxes.setarena( arena );
+			contacts.setarena( arena );
+			contactpoints.setarena( arena );
+			events.setarena( arena );
+			touching.setarena( arena );
+			pairranges.setarena( arena );
+			groundranges.setarena( arena );
+			found.setarena( arena );
+			movers.setarena( arena );
+			solvercontacts.setarena( arena );
+			solverpoints.setarena( arena );
+			lastids.setarena( arena );
+			splitvel.setarena( arena );
+			splitangvel.setarena( arena );
+			batchorder.setarena( arena );
+			batchstarts.setarena( arena );
+			colormasks.setarena( arena );
+			while( (int)lanes.size() < jobs.threads() )
+				lanes.emplace_back();
+			for( unsigned int l = 0; l < lanes.size(); l++ )
+				lanes[l].reset();
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Like reset(), but keeps this step's constraints around for warm
+		// starting the next, and its separating axes for rejectpairs(). update() calls this first thing every step.
+		void nextstep( void ) {
+			lastcontacts.swap( solvercontacts );
+			lastpoints.swap( solverpoints );
+			lastobbs.swap( obbs );
+			lastsepaxes.swap( sepaxes );
+			lasttouching.swap( touching );
+			newframe();
+			renameboxes();
+			for( int c = 0; c < lastcontacts.size(); c++ )
+				lastids.push_back( std::make_pair(lastcontacts[c].id, c) );
+			std::sort( lastids.begin(), lastids.end() );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Box _idx of _numboxes is gone and the last box takes its index(see
+		// PBox::removebox()). Remembered until the next step starts.
+		void removebox( int _idx, int _numboxes ) {
+			startrenames( _numboxes );
+			int last = _numboxes - 1;
+			if( oldindex[_idx] >= 0 )
+				newindex[ oldindex[_idx] ] = -1;
+			oldindex[_idx] = oldindex[last];
+			if( oldindex[_idx] >= 0 )
+				newindex[ oldindex[_idx] ] = _idx;
+			oldindex.pop_back();
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// The _numboxes boxes were shuffled, box b is the one that was at
+		// _order[b](see PBox::sortboxes()). Remembered until the next step
+		// starts, like removebox().
+		void reorderboxes( const int *_order, int _numboxes ) {
+			startrenames( _numboxes );
+			std::vector <int> was( oldindex );
+			for( int b = 0; b < _numboxes; b++ ) {
+				oldindex[b] = was[ _order[b] ];
+				if( oldindex[b] >= 0 )
+					newindex[ oldindex[b] ] = b;
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Gets oldindex/newindex ready for renames of _numboxes boxes. Every
+		// box keeps its index until something moves it.
+		void startrenames( int _numboxes ) {
+			if( newindex.empty() ) {
+				newindex.resize( numboxes );
+				for( int b = 0; b < numboxes; b++ )
+					newindex[b] = b;
+				oldindex = newindex;
+			}
+			// Added since the last step, no history.
+			while( (int)oldindex.size() < _numboxes )
+				oldindex.push_back( -1 );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Box _idx's index now, from its index last step. -1 if it's gone.
+		int renamed( unsigned int _idx ) const {
+			return ( _idx < newindex.size() ) ? newindex[_idx] : -1;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Moves last step's box OBBs, separating axes, touching pairs and
+		// constraints over to the boxes' new indices. Anything with a removed
+		// box is dropped, so removed boxes get no end events. So are axes and
+		// constraints for pairs whose boxes swapped order, they're in the
+		// other box's terms.
+		void renameboxes( void ) {
+			if( newindex.empty() )
+				return;
+
+			// OBBs move with their box. New boxes get one that never
+			// matches, they haven't been still.
+			if( !lastobbs.empty() ) {
+				PArenaArray <PBoxOBB> moved( &frames[frame] );
+				PBoxOBB none = lastobbs[0];
+				none.radius = -1.0f;
+				moved.resize( oldindex.size(), none );
+				for( unsigned int b = 0; b < oldindex.size(); b++ )
+					if( oldindex[b] >= 0 && oldindex[b] < lastobbs.size() )
+						moved[b] = lastobbs[ oldindex[b] ];
+				lastobbs.swap( moved );
+			}
+
+			int kept = 0;
+			for( int s = 0; s < lastsepaxes.size(); s++ ) {
+				int a = renamed( (unsigned int)(lastsepaxes[s].id >> 32) );
+				int b = renamed( (unsigned int)lastsepaxes[s].id );
+				if( a < 0 || b < 0 || a > b ) continue;
+				lastsepaxes[kept].id = PPair( a, b ).id();
+				lastsepaxes[ kept++ ].axis = lastsepaxes[s].axis;
+			}
+			lastsepaxes.resize( kept );
+			std::sort( lastsepaxes.begin(), lastsepaxes.end(), []( const PPairAxis &_a, const PPairAxis &_b ) {
+				return _a.id < _b.id;
+			} );
+
+			// Touching pairs don't care which box is first.
+			kept = 0;
+			for( int t = 0; t < lasttouching.size(); t++ ) {
+				PContactEvent touch = lasttouching[t];
+				touch.a = renamed( touch.a );
+				touch.box = renamed( touch.box );
+				if( touch.a < 0 ) continue;
+				if( touch.b >= 0 ) {
+					touch.b = renamed( touch.b );
+					if( touch.b < 0 ) continue;
+					if( touch.b < touch.a )
+						std::swap( touch.a, touch.b );
+				}
+				touch.id = contactid( touch.a, touch.b );
+				lasttouching[ kept++ ] = touch;
+			}
+			lasttouching.resize( kept );
+			std::sort( lasttouching.begin(), lasttouching.end(), sortevents );
+
+			// Their points stay put in lastpoints, only the contacts move. a
+			// stays the dynamic box, whatever its index. Two dynamic boxes
+			// that swapped order get the other a next step, and
+			// PBox::buildcontacts() skips those.
+			kept = 0;
+			for( int c = 0; c < lastcontacts.size(); c++ ) {
+				PSolverContact sc = lastcontacts[c];
+				sc.a = renamed( sc.a );
+				if( sc.a < 0 ) continue;
+				if( sc.b >= 0 ) {
+					sc.b = renamed( sc.b );
+					if( sc.b < 0 ) continue;
+					sc.id = contactid( sc.a, sc.b );
+				}
+				else
+					sc.id = ( (unsigned long long)(unsigned int)sc.a << 32 ) | ( sc.id & 0xFFFFFFFFull );
+				lastcontacts[ kept++ ] = sc;
+			}
+			lastcontacts.resize( kept );
+
+			oldindex.clear();
+			newindex.clear();
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Last step's constraint with this id, or 0.
+		PSolverContact *findlastcontact( unsigned long long _id ) {
+			std::pair<unsigned long long, int> *it =
+				std::lower_bound( lastids.begin(), lastids.end(), std::make_pair(_id, -1) );
+			if( it == lastids.end() || it->first != _id ) return 0;
+			return &lastcontacts[ it->second ];
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Adds ground.
+		void addplane( const PPlane &_plane ) { planes.push_back( _plane ); }
+		void addheightfield( const PHeightfield &_field ) { heightfields.push_back( _field ); }
+
+		///////////////////////////////////////////////////////////////////////
+		// Removes all planes and heightfields.
+		void clearground( void ) {
+			planes.clear();
+			heightfields.clear();
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Forgets every static box.
+		void clearstatics( void ) {
+			statictree.clear();
+			staticboxes.clear();
+			staticgeoms.clear();
+			staticslots.clear();
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Gets rid of this step's pairs and contacts, and last step's
+		// impulses, separating axes and touching pairs. Keeps the memory.
+		void reset( void ) {
+			newframe();
+			oldindex.clear();
+			newindex.clear();
+			lastcontacts.setarena( &frames[frame] );
+			lastpoints.setarena( &frames[frame] );
+			lastobbs.setarena( &frames[frame] );
+			lastsepaxes.setarena( &frames[frame] );
+			lasttouching.setarena( &frames[frame] );
+		}
+};
+
+#endif // PWORLD_H
@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// PWorlds - Many Small Worlds(for PBox)
+//
+// Thousands of scenes of 10 to 200 boxes each, stepped together. Stepping
+// them one after another leaves threads idle, since a world that small is
+// all overhead to PJobs. So each world is stepped whole on one thread, and
+// the worlds are what gets spread over the threads...
+// * Every world is a PWorld of its own(settings, ground, octree, contacts)
+//   with 1 thread.
+// * Every world's boxes are packed back to back in one array, world 0's
+//   first.
+// * update() hands worlds out a few at a time, enough boxes per piece to
+//   be worth taking, and steps each one every step asked for before moving
+//   on. Its boxes and scratch stay in cache the whole time.
+//
+// Each world is handed to PBox::update() itself, with the thread stepping
+// it made lane 0 of the world's pool(see PJobs::Scope). Worlds are
+// independent and deterministic, any thread count gives the same boxes.
+//
+// Usage:
+// PWorlds batch;
+// batch.jobs.setthreads( 8 );
+// for( int w = 0; w < 1000; w++ ) {
+// 		int idx = batch.add( scene, 50 );
+// 		batch.world( idx ).addplane( PPlane(vec3(0, 1, 0), 0.0f) );
+// }
+// batch.update( 10 );
+// PBox *boxes = batch.getboxes( 0 );
+//
+///////////////////////////////////////////////////////////////////////////////
+#ifndef PWORLDS_H
+#define PWORLDS_H
+
+// Lists of things.
+#include <vector>
+#include <deque>
+
+// Boxes and update().
+#include "PBox.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Worlds stepped as a batch.
+class PWorlds {
+	public:
+		// Least boxes update() hands a thread at a time. Fewer and threads
+		// spend their time taking work instead of doing it.
+		static const int BATCHBOXES = 256;
+
+		// Every world's boxes, packed. Change them between update()s, but
+		// don't add or remove any, use add()/clear().
+		std::vector <PBox> boxes;
+		// Threads the worlds are spread over. The worlds' own stay at 1.
+		PJobs jobs;
+
+		///////////////////////////////////////////////////////////////////////
+		// Adds a world with copies of _numboxes boxes from _boxes. Returns
+		// its index, for setting it up with world().
+		int add( const PBox *_boxes, int _numboxes ) {
+			worlds.emplace_back();
+			// Small scenes in a big dense tree waste most of it.
+			worlds.back().tree.sparse = true;
+			firsts.push_back( boxes.size() );
+			counts.push_back( _numboxes );
+			boxes.insert( boxes.end(), _boxes, _boxes + _numboxes );
+			return worlds.size() - 1;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// World _w's settings and scratch, same as pworld.
+		PWorld &world( int _w ) { return worlds[_w]; }
+
+		///////////////////////////////////////////////////////////////////////
+		// World _w's boxes. Good until the next add().
+		PBox *getboxes( int _w ) { return counts[_w] ? &boxes[ firsts[_w] ] : 0; }
+		int numboxes( int _w ) const { return counts[_w]; }
+
+		int size( void ) const { return worlds.size(); }
+
+		///////////////////////////////////////////////////////////////////////
+		// Steps every world _steps times.
+		void update( int _steps = 1 ) {
+			int numworlds = worlds.size();
+			if( numworlds == 0 || _steps < 1 )
+				return;
+			int grain = ( BATCHBOXES * numworlds ) / ( boxes.size() + 1 ) + 1;
+			jobs.parallelfor( numworlds, [&]( int _w, int ) {
+				if( counts[_w] == 0 )
+					return;
+				PJobs::Scope scope( 0 );
+				for( int s = 0; s < _steps; s++ )
+					PBox::update( worlds[_w], &boxes[ firsts[_w] ], counts[_w] );
+			}, grain );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Removes every world.
+		void clear( void ) {
+			worlds.clear();
+			firsts.clear();
+			counts.clear();
+			boxes.clear();
+		}
+
+	private:
+		// PWorlds can't be copied or moved, so a deque.
+		std::deque <PWorld> worlds;
+		// Where each world's boxes start in boxes, and how many.
+		std::vector <int> firsts;
+		std::vector <int> counts;
+};
+
+#endif // PWORLDS_H
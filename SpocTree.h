@@ -5,12 +5,53 @@
 // Creates an octree for collision detection.
 // Accepts position and radius of sphere, but internally creates
 // "bounding boxes."
+//
+// Two ways to build it...
+// * Full(default) - every node down to _depth, up front.
+// * Sparse - just the root. A node splits once more than splitcount
+//   spheres land in it, and its children are merged back when the
+//   spheres under it drop to mergecount. Nodes only exist where the
+//   spheres are, _depth is only a limit.
+//
+// A sphere outside the root grows the tree. A root twice the size goes
+// on top, reaching toward the sphere, until the sphere fits. The world
+// doesn't need a size, buildtree()'s is just where it starts. Sparse
+// trees only fill in what they need of the new space, full trees leave
+// each new octant as a single leaf, so sparse is the one for big worlds.
+//
+// placespheres() puts a whole list of spheres in at once. They're sorted
+// by Morton key(their center's cell in the root, bits of x/y/z
+// interleaved), which lines up every node's spheres next to each other,
+// and handed down the tree in runs instead of one at a time. With jobs
+// set it runs on every thread. The sort is split into chunks, and below
+// the top couple of levels every subtree is its own job. Subtrees don't
+// share nodes, and each thread(lane) keeps bucket indices in its own
+// arena, so threads never wait on each other for nodes or memory.
+//
+// Spheres can have layers, 32 bits of whatever the user likes. With
+// layered set, every node keeps the layers of the spheres in and under it,
+// so query() can skip a whole subtree that has nothing in the layers it's
+// after.
+//
+// Usage:
+// sptree.sparse = true;
+// sptree.buildtree( 5, vec3(150, 150, 150) );
+#ifndef SPOCTREE_H
+#define SPOCTREE_H
 
 // Lists of things.
 #include <vector>
-#include <list>
+#include <deque>
+// std::sort(), std::swap().
+#include <algorithm>
+// Bucket indices live in an arena.
+#include "PArena.h"
+// Threads for placespheres().
+#include "PJobs.h"
 // vectors and such.
 #include "Glm_Lite.h"
+// PSTATS_ADD() for counting visited nodes.
+#include "PStats.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // Representation of sphere.
@@ -22,6 +63,8 @@
 struct Sfear {
 	vec3 pos;
 	float rad;
+	// Layer bits, all of them by default.
+	unsigned int layers;
 	// vec3 poslm;
 	// vec3 neglm;
 };
@@ -39,8 +82,9 @@ struct Spocket {
 	// Upper and lower limits to volume.
 	vec3 poslm;
 	vec3 neglm;
-	// Indices into sphere list.
-	std::vector <int> sindices;
+	// Indices into sphere list. Memory comes from the tree's arena, or
+	// the arena of the lane that placed them.
+	PArenaArray <int> sindices;
 	int numsindices;
 	// Children of this object.
 	// If looking down at the volume(-Y), children order is clockwise:
@@ -52,6 +96,16 @@ struct Spocket {
 	// Parent node.
 	// 0 if root.
 	Spocket *parent;
+	// Levels below the root. Root is 0.
+	int depth;
+	// Spheres placed in this node or below it since the last
+	// clearshortlist(). Only counted for sparse trees.
+	int numinside;
+	// In SpocTree's shortlist.
+	bool listed;
+	// Layers of every sphere in this node or below it. Only kept when the
+	// tree is layered, and only since the last clearshortlist().
+	unsigned int layers;
 
 	// Initializes Spocket.
 	Spocket() {
@@ -63,9 +117,41 @@ struct Spocket {
 		for( int c = 0; c < 8; c++ )
 			childs[c] = 0;
 		parent = 0;
+		depth = 0;
+		numinside = 0;
+		listed = false;
+		layers = 0;
 	}
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Sphere index and its Morton key, for SpocTree::placespheres().
+struct SpocKey {
+	unsigned int key;
+	int sidx;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// A node and the sorted keys/spheres that go under it.
+struct SpocRun {
+	Spocket *node;
+	SpocKey *keys;
+	vec3 *spheres;
+	int count;
+	int level;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// One thread's scratch while placing spheres. Bucket indices placed by that
+// thread live in arena until the next clearshortlist().
+struct SpocLane {
+	PArena arena;
+	// Nodes this lane put in the shortlist, merged in afterwards.
+	PArenaArray <Spocket *> listed;
+	unsigned int nodesvisited;
+	SpocLane(): nodesvisited(0) { listed.setarena( &arena ); }
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Sphere/Octree.
 //
@@ -79,22 +165,74 @@ class SpocTree {
 		// Sfear(Sphere) list.
 		std::vector <Sfear> slist;
 
-		// List of buckets. Root is the first element.
-		std::list <Spocket> bucketlist;
+		// List of buckets. A deque, so pointers to nodes stay put as the
+		// tree grows. Nodes merged away have an id of -1 and wait in
+		// freenodes to be used again.
+		std::deque <Spocket> bucketlist;
+		std::vector <Spocket *> freenodes;
+
+		// Top of the tree. bucketlist's first element until the tree grows.
+		Spocket *root;
 
 		// List of buckets that contain indices.
 		// By creating a smaller list, we're reducing the number of buckets we
 		// have to check. Granted, you could just iterate through all buckets
 		// to see if indices were added, but that could potentially be thousands of
 		// checks.
-		std::vector <Spocket *> shortlist;
+		PArenaArray <Spocket *> shortlist;
+
+		// Memory for shortlist and every bucket's indices. Thrown away by
+		// clearshortlist(), so refreshing the tree every step doesn't
+		// allocate.
+		PArena arena;
 
 		// The number of nodes the tree has.
 		int numnodes;
 
+		// Sparse tree settings. Set before buildtree().
+		bool sparse;
+		// Node splits when it holds more than this many spheres...
+		int splitcount;
+		// ...and loses its children when it and they hold this many or
+		// less. Keep it well under splitcount or nodes will split and merge
+		// every other step.
+		int mergecount;
+		// Deepest a node can be. buildtree()'s _depth, plus one for every
+		// time the root grew.
+		int maxdepth;
+		// Next node id.
+		int nextid;
+
+		// Grow the root for spheres outside it. If false they're left out
+		// of the tree.
+		bool grow;
+
+		// Keep every node's layers(see Spocket::layers). Off by default, turn
+		// it on before placing spheres.
+		bool layered;
+
+		// Threads for placespheres(). 0 runs everything on the calling
+		// thread.
+		PJobs *jobs;
+		// placespheres() stays on one thread for fewer spheres than this.
+		static const int PARALLELMIN = 2048;
+		// Scratch for lanes 1 and up, one per thread. Lane 0 uses arena and
+		// shortlist, and is only used by the thread calling placespheres().
+		std::deque <SpocLane> lanes;
+		// newnode()/makechildren() can run on any lane.
+		std::mutex nodelock;
+		// Most doublings for one sphere. Enough to go from 1 to 1e9, stops
+		// a far away sphere from growing the tree forever.
+		static const int MAXGROWS = 30;
+
+		// Nodes visited by _addsphere() and getbucket() since this was last
+		// zeroed. Only counted when PBOX_STATS is defined.
+		unsigned int nodesvisited;
+
 		///////////////////////////////////////////////////////////////////////
 		// Def C-Tor.
-		SpocTree(): numnodes(0) {  }
+		SpocTree(): root(0), numnodes(0), sparse(false), splitcount(8), mergecount(4), maxdepth(0),
+					nextid(0), grow(true), layered(false), jobs(0), nodesvisited(0) { shortlist.setarena( &arena ); }
 		///////////////////////////////////////////////////////////////////////
 		// Def Destructor.
 		~SpocTree() { clear(); }
@@ -104,18 +242,20 @@ class SpocTree {
         //
         // Note: We're passing a sphere because creating a new one and returning
         // it cost a lot of cycles.
-        void buildsphere( Sfear &sf, const vec3 &_pos, float _radius ) {
-            sf.pos = _pos;
+        void buildsphere( Sfear &sf, const vec3 &_pos, float _radius, unsigned int _layers = 0xFFFFFFFF ) {
+            sf.pos = _pos;
 			sf.rad = _radius;
+			sf.layers = _layers;
         }
 
 		///////////////////////////////////////////////////////////////////////
 		// Add a sphere to the list.
 		// _pos - position.
-		// _radius...
-		void addsphere( const vec3 &_pos, float _radius ) {
+		// _radius...
+		// _layers - layer bits, see layered.
+		void addsphere( const vec3 &_pos, float _radius, unsigned int _layers = 0xFFFFFFFF ) {
 			Sfear nsfw;
-			buildsphere( nsfw, _pos, _radius );
+			buildsphere( nsfw, _pos, _radius, _layers );
 			//vec3 poslm = nsfw.pos + vec3( _radius, _radius, _radius );
 			//vec3 neglm = nsfw.pos - vec3( _radius, _radius, _radius );
 			slist.push_back( nsfw );
@@ -127,7 +267,8 @@ class SpocTree {
 		// initialization.
 		//
 		// _depth determines how many times we split up the tree.
-		// Can improve/degrade performance.
+		// Can improve/degrade performance. Sparse trees start with just the
+		// root and split as far as _depth when they need to.
 		// A depth of 1 is default and will produce the root and 8 children.
 		// Depth of 0 will just have the root, which is just a big bounding
 		// box containing all Sfears.
@@ -141,20 +282,28 @@ class SpocTree {
 		// Helps scenarios where objects are axis aligned.
 		// Can improve/degrade performance.
 		//
-		// Return - A pointer to a list(vector) containing nodes that
-		// have sphere indices.
-		std::vector<Spocket *> *buildtree( const int _depth = 1,
+		// _place - false builds the nodes but leaves every sphere out. Place
+		// the ones you want with refreshsphere().
+		//
+		// Return - A pointer to a list containing nodes that have sphere
+		// indices.
+		PArenaArray<Spocket *> *buildtree( const int _depth = 1,
 										   const vec3 &_size = vec3(100, 100, 100),
-										   const vec3 &_pos = vec3(0, 0, 0) ) {
+										   const vec3 &_pos = vec3(0, 0, 0),
+										   bool _place = true ) {
 			// This octree implementation can't use negative numbers.
 			if( _depth < 0 ) return 0;
 
 			// We're rebuilding the tree so no nodes yet.
 			numnodes = 0;
+			maxdepth = _depth;
 
 			// Clear the bucket list in case our own clear()
-			// wasn't called.
+			// wasn't called. Old indices go with it.
 			bucketlist.clear();
+			freenodes.clear();
+			shortlist.clear();
+			resetarenas();
 
 			// Create new root.
 			Spocket sproot;
@@ -164,25 +313,40 @@ class SpocTree {
 			sproot.neglm = sproot.poslm * -1 + _pos;
 			// No parent.
 			sproot.parent = 0;
+			sproot.sindices.setarena( &arena );
 
 			// Id's help with testing for duplicate nodes in lists.
-			int globid = 0;
+			nextid = 0;
 
 			// Root node gets the first id.
-			sproot.id = globid++;
+			sproot.id = nextid++;
+
+			// Sparse trees grow as spheres are added.
+			if( sparse ) {
+				bucketlist.push_back( sproot );
+				root = &bucketlist[0];
+				numnodes = 1;
+				if( _place )
+					addspherestotree();
+				return &shortlist;
+			}
 
 			// If depth is 0, add indices to root.
 			if( _depth == 0 ) {
 				// Add indices.
-				for( unsigned int s = 0; s < slist.size(); s++ )
+				for( unsigned int s = 0; _place && s < slist.size(); s++ ) {
 					sproot.sindices.push_back( s );
+					if( layered )
+						sproot.layers |= slist[s].layers;
+				}
 				sproot.numsindices = sproot.sindices.size();
 				// Add root to list.
 				bucketlist.push_back( sproot );
+				root = &bucketlist[0];
 				numnodes = 1;
 				// Update shortlist. Even with 1 node, the user
 				// will still need it.
-				shortlist.push_back( &*bucketlist.begin() );
+				addtoshortlist( root );
 				// Give 'em the short list so they can check
 				// for collisions already.
 				return &shortlist;
@@ -195,65 +359,195 @@ class SpocTree {
 			// The number of nodes we've created so far.
 			// About to add root.
 			numnodes = 1;
-			// This is used to track parent nodes for
-			// children.
-			Spocket *sp = 0;
 			// Add root to list.
 			bucketlist.push_back( sproot );
+			root = &bucketlist[0];
 
-			// Iterator for bucket list. Ugh...
-			std::list<Spocket>::iterator buckit = bucketlist.begin();
+			// Next parent in the bucket list.
+			int buckit = 0;
 
 			// Loop until we've created enough nodes.
 			while( numnodes < maxnodes ) {
-
-				// Point to current parent.
-				sp = &*buckit;
-
-				// Create 8 child nodes.
-				for( int c = 0; c < 8; c++ ) {
-					// Child node length.
-					vec3 clen = ((sp->poslm - sp->neglm) / 2);
-					// Parent origin. Later calculated to
-					// child origin.
-					vec3 opos = sp->neglm + clen;
-					// Axis lengths.
-					vec3 xvec = clen * vec3( 0.5f, 0, 0 );
-					vec3 yvec = clen * vec3( 0, 0.5f, 0 );
-					vec3 zvec = clen * vec3( 0, 0, 0.5f );
-					// Adjust child origin.
-					// Need a different(but particular) one for all eight.
-					// Top childs.
-					if( c == 0 ) opos = opos - xvec + yvec + zvec;
-					if( c == 1 ) opos = opos + xvec + yvec + zvec;
-					if( c == 2 ) opos = opos + xvec + yvec - zvec;
-					if( c == 3 ) opos = opos - xvec + yvec - zvec;
-					// Bottom childs.
-					if( c == 4 ) opos = opos - xvec - yvec + zvec;
-					if( c == 5 ) opos = opos + xvec - yvec + zvec;
-					if( c == 6 ) opos = opos + xvec - yvec - zvec;
-					if( c == 7 ) opos = opos - xvec - yvec - zvec;
-					// Set id, bounds, and parent.
-					bucketlist.push_back( Spocket() );
-					bucketlist.back().id = globid++;
-					bucketlist.back().poslm = opos + xvec + yvec + zvec;
-					bucketlist.back().neglm = opos - xvec - yvec - zvec;
-					bucketlist.back().parent = sp;
-					sp->childs[c] = &bucketlist.back();
-					numnodes++;
-				}
+				makechildren( &bucketlist[buckit] );
 				buckit++;
-
 			} // while()
 
 			// Put spheres in their place...
-			addspherestotree();
+			if( _place )
+				addspherestotree();
 
 			// Return the short list.
 			return &shortlist;
 
 		} // buildtree()
 
+		///////////////////////////////////////////////////////////////////////
+		// Creates 8 child nodes for sp. Reuses merged away nodes if there
+		// are any.
+		void makechildren( Spocket *sp ) {
+			for( int c = 0; c < 8; c++ ) {
+				// Child node length.
+				vec3 clen = ((sp->poslm - sp->neglm) / 2);
+				// Parent origin. Later calculated to
+				// child origin.
+				vec3 opos = sp->neglm + clen;
+				// Axis lengths.
+				vec3 xvec = clen * vec3( 0.5f, 0, 0 );
+				vec3 yvec = clen * vec3( 0, 0.5f, 0 );
+				vec3 zvec = clen * vec3( 0, 0, 0.5f );
+				// Adjust child origin.
+				// Need a different(but particular) one for all eight.
+				// Top childs.
+				if( c == 0 ) opos = opos - xvec + yvec + zvec;
+				if( c == 1 ) opos = opos + xvec + yvec + zvec;
+				if( c == 2 ) opos = opos + xvec + yvec - zvec;
+				if( c == 3 ) opos = opos - xvec + yvec - zvec;
+				// Bottom childs.
+				if( c == 4 ) opos = opos - xvec - yvec + zvec;
+				if( c == 5 ) opos = opos + xvec - yvec + zvec;
+				if( c == 6 ) opos = opos + xvec - yvec - zvec;
+				if( c == 7 ) opos = opos - xvec - yvec - zvec;
+				// Set id, bounds, and parent.
+				Spocket *child = newnode();
+				child->poslm = opos + xvec + yvec + zvec;
+				child->neglm = opos - xvec - yvec - zvec;
+				child->parent = sp;
+				child->depth = sp->depth + 1;
+				sp->childs[c] = child;
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// A blank node with an id, from freenodes if there are any.
+		Spocket *newnode( void ) {
+			std::lock_guard <std::mutex> lock( nodelock );
+			Spocket *node;
+			if( freenodes.empty() ) {
+				bucketlist.push_back( Spocket() );
+				node = &bucketlist.back();
+			}
+			else {
+				node = freenodes.back();
+				freenodes.pop_back();
+				*node = Spocket();
+			}
+			node->id = nextid++;
+			node->sindices.setarena( &arena );
+			numnodes++;
+			return node;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Puts a root twice the size on top of the current one, reaching
+		// toward _toward on every axis. The old root becomes one of its
+		// children and everything under it moves down a level.
+		void growroot( const vec3 &_toward ) {
+			for( unsigned int n = 0; n < bucketlist.size(); n++ )
+				if( bucketlist[n].id >= 0 )
+					bucketlist[n].depth++;
+			maxdepth++;
+
+			Spocket *old = root;
+			vec3 len = old->poslm - old->neglm;
+			vec3 mid = old->neglm + len / 2;
+			vec3 neg = old->neglm;
+			vec3 pos = old->poslm;
+			if( _toward.x < mid.x ) neg.x -= len.x; else pos.x += len.x;
+			if( _toward.y < mid.y ) neg.y -= len.y; else pos.y += len.y;
+			if( _toward.z < mid.z ) neg.z -= len.z; else pos.z += len.z;
+
+			root = newnode();
+			root->poslm = pos;
+			root->neglm = neg;
+			// Spheres placed this step are still under it.
+			root->numinside = old->numinside;
+			root->layers = old->layers;
+			makechildren( root );
+
+			// Swap the child sitting where the old root is for the old root.
+			for( int c = 0; c < 8; c++ ) {
+				Spocket *child = root->childs[c];
+				if( mid.x > child->neglm.x && mid.x < child->poslm.x &&
+					mid.y > child->neglm.y && mid.y < child->poslm.y &&
+					mid.z > child->neglm.z && mid.z < child->poslm.z ) {
+					child->id = -1;
+					child->parent = 0;
+					freenodes.push_back( child );
+					numnodes--;
+					root->childs[c] = old;
+					old->parent = root;
+					break;
+				}
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Puts sphere _sidx in the tree, growing the tree if it's outside.
+		// False if it's still outside(or not a number).
+		bool placesphere( int _sidx ) {
+			if( _addsphere( root, _sidx ) )
+				return true;
+			// inf - inf and NaN - NaN aren't 0, no point growing for those.
+			const vec3 &pos = slist[_sidx].pos;
+			float rad = slist[_sidx].rad;
+			if( !grow || pos.x - pos.x != 0 || pos.y - pos.y != 0 || pos.z - pos.z != 0 ||
+				rad - rad != 0 )
+				return false;
+			for( int g = 0; g < MAXGROWS; g++ ) {
+				growroot( pos );
+				if( _addsphere( root, _sidx ) )
+					return true;
+			}
+			return false;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Sparse trees. Gives _node children and hands its spheres down to
+		// the ones that can hold them.
+		void split( Spocket *_node, int _lane = 0 ) {
+			makechildren( _node );
+			PArenaArray <int> old = _node->sindices;
+			_node->sindices.setarena( lanearena(_lane) );
+			for( int s = 0; s < old.size(); s++ ) {
+				bool placed = false;
+				for( int c = 0; c < 8 && !placed; c++ )
+					placed = _addsphere( _node->childs[c], old[s], _lane );
+				if( !placed )
+					keep( _node, old[s], _lane );
+			}
+			_node->numsindices = _node->sindices.size();
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Sparse trees. Throws away _node's children(and theirs) for
+		// makechildren() to reuse. They must not hold any spheres.
+		void freechildren( Spocket *_node ) {
+			for( int c = 0; c < 8; c++ ) {
+				Spocket *child = _node->childs[c];
+				if( child->childs[0] )
+					freechildren( child );
+				child->id = -1;
+				child->parent = 0;
+				freenodes.push_back( child );
+				_node->childs[c] = 0;
+				numnodes--;
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Sparse trees. Merges every node that held mergecount spheres or
+		// less since the last call, and zeroes the counts.
+		void prune( Spocket *_node ) {
+			if( _node->childs[0] ) {
+				if( _node->numinside <= mergecount )
+					freechildren( _node );
+				else
+					for( int c = 0; c < 8; c++ )
+						prune( _node->childs[c] );
+			}
+			_node->numinside = 0;
+		}
+
 		///////////////////////////////////////////////////////////////////////
 		// Takes a vector3 which contains a sphere's position and radius.
 		// vec3( p.x, p.y, p.z, radius ).
@@ -268,34 +562,16 @@ class SpocTree {
 		bool sphereboxinbox( const vec3 &s, const vec3 _box[2] ) {
 
 			// Pull out pos and radius.
-			vec3 ps = s;
 			float rd = s.w;
 
-			// Front Face.
-			// Low x, Low y, Low z(close to cam)
-			if( !pntinbox( ps + vec3(-rd, -rd, -rd), _box ) )
-				return false;
-			// Low x, High y, Low z.
-			if( !pntinbox( ps + vec3(-rd, rd, -rd), _box ) )
-				return false;
-			// High x, High y, Low z.
-			if( !pntinbox( ps + vec3(rd, rd, -rd), _box ) )
-				return false;
-			// High x, Low y, Low z.
-			if( !pntinbox( ps + vec3(rd, -rd, -rd), _box ) )
-				return false;
-			// Back Face.
-			// Low x, Low y, High z.
-			if( !pntinbox( ps + vec3(-rd, -rd, rd), _box ) )
-				return false;
-			// Low x, High y, High z.
-			if( !pntinbox( ps + vec3(-rd, rd, rd), _box ) )
+			// The sphere's box is inside if its low and high corners are,
+			// which covers the other six. Written so NaN compares as inside,
+			// like pntinbox() does.
+			if( s.x - rd < _box[1].x || s.x + rd > _box[0].x )
 				return false;
-			// High x, High y, High z.
-			if( !pntinbox( ps + vec3(rd, rd, rd), _box ) )
+			if( s.y - rd < _box[1].y || s.y + rd > _box[0].y )
 				return false;
-			// High x, Low y, High z.
-			if( !pntinbox( ps + vec3(rd, -rd, rd), _box ) )
+			if( s.z - rd < _box[1].z || s.z + rd > _box[0].z )
 				return false;
 			// All of the points are within the box!
 			return true;
@@ -324,15 +600,42 @@ class SpocTree {
 
 		///////////////////////////////////////////////////////////////////////
 		// Add a bucket pointer to the shortlist. Prevents duplicates.
-		void addtoshortlist( Spocket *_node ) {
+		// Lanes other than 0 keep their own list until placespheres() is done.
+		void addtoshortlist( Spocket *_node, int _lane = 0 ) {
 			// Make sure it's not already in there.
-			int sz = shortlist.size();
-			for( int cn = 0; cn < sz; cn++ )
-				if( shortlist[cn]->id == _node->id )
-					return;
+			if( _node->listed )
+				return;
 			// Looks like that node wasn't already in the list.
 			// Safe to add.
-			shortlist.push_back( _node );
+			_node->listed = true;
+			if( _lane )
+				lanes[_lane - 1].listed.push_back( _node );
+			else
+				shortlist.push_back( _node );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Arena bucket indices placed by _lane go in.
+		PArena *lanearena( int _lane ) {
+			return _lane ? &lanes[_lane - 1].arena : &arena;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Nodes visited, counted per lane so threads don't share a counter.
+		unsigned int &lanevisits( int _lane ) {
+			return _lane ? lanes[_lane - 1].nodesvisited : nodesvisited;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Adds _sidx to _node's indices, moving them to _lane's arena first
+		// if they're somewhere else.
+		void keep( Spocket *_node, int _sidx, int _lane ) {
+			PArena *la = lanearena( _lane );
+			if( _node->sindices.getarena() != la )
+				_node->sindices.moveto( la );
+			_node->sindices.push_back( _sidx );
+			if( layered )
+				_node->layers |= slist[_sidx].layers;
 		}
 
         ///////////////////////////////////////////////////////////////////////
@@ -352,8 +655,9 @@ class SpocTree {
 
 		///////////////////////////////////////////////////////////////////////
 		// Recursively adds a sphere index to one of the octree
-		// nodes.
-		bool _addsphere( Spocket *_node, int _sidx ) {
+		// nodes. _lane is the thread doing it(see placespheres()).
+		bool _addsphere( Spocket *_node, int _sidx, int _lane = 0 ) {
+			PSTATS_ADD( lanevisits(_lane), 1 );
 			// Get the sphere and Spocket bounds.
 			vec3 spheer;
 			vec3 bx[2];
@@ -361,21 +665,31 @@ class SpocTree {
 
 			// Is the sphere within this box?
 			if( sphereboxinbox(spheer, bx) ) {
+				if( sparse )
+					_node->numinside++;
+				// It ends up here or below, so the layers are too.
+				if( layered )
+					_node->layers |= slist[_sidx].layers;
 				// The sphere may be in one of its children, too.
 				if( _node->childs[0] ) {
 					for( int ch = 0; ch < 8; ch++ ) {
-						if( _addsphere( _node->childs[ch], _sidx ) ) {
+						if( _addsphere( _node->childs[ch], _sidx, _lane ) ) {
 							return true;
 						}
 					}
 				}
 				// If none of the children(if they existed) could house our
 				// sphere, we'll keep it.
-				_node->sindices.push_back( _sidx );
+				keep( _node, _sidx, _lane );
 				_node->numsindices = _node->sindices.size();
 
 				// Add this node to the short list.
-				addtoshortlist( _node );
+				addtoshortlist( _node, _lane );
+
+				// Too crowded, sparse leaves get children.
+				if( sparse && !_node->childs[0] && _node->depth < maxdepth &&
+					_node->numsindices > splitcount )
+					split( _node, _lane );
 
 				// Sphere placed. Success.
 				return true;
@@ -389,13 +703,371 @@ class SpocTree {
 		///////////////////////////////////////////////////////////////////////
 		// Add spheres/indices to appropriate bucket/leaf nodes in tree.
 		void addspherestotree( void ) {
-			// Iterator for bucket list. Ugh...
-			Spocket *sproot = &*bucketlist.begin();
-
 			// All spheres, add to tree.
-			for( unsigned int sidx = 0; sidx < slist.size(); sidx++ ) {
-					_addsphere( sproot, sidx );
+			int numspheres = slist.size();
+			int *all = arena.alloc<int>( numspheres );
+			for( int sidx = 0; sidx < numspheres; sidx++ )
+				all[sidx] = sidx;
+			placespheres( all, numspheres );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Moves sphere _sidx without putting it in the tree. For moving a lot
+		// of them and then placespheres()-ing them all.
+		void movesphere( int _sidx, const vec3 &_pos ) {
+			slist[_sidx].pos = _pos;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Takes sphere _sidx out of the list and the tree. The last sphere
+		// moves into its index, like swap-removing from an array. Spheres
+		// have to be where they were placed.
+		// Buckets only hold indices while they're in the shortlist, so with
+		// an empty one(between steps, after clearshortlist()) it's just the
+		// swap.
+		void removesphere( int _sidx ) {
+			int last = slist.size() - 1;
+			if( !shortlist.empty() ) {
+				renamesphere( _sidx, -1 );
+				if( _sidx != last )
+					renamesphere( last, _sidx );
+			}
+			slist[_sidx] = slist[last];
+			slist.pop_back();
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Finds _sidx in its bucket and changes it to _to, or takes it out if
+		// _to is -1. The bucket stays in index order.
+		void renamesphere( int _sidx, int _to ) {
+			Spocket *node = getbucket( _sidx );
+			if( !findsphere(node, _sidx, _to) ) {
+				// A sphere right on the line between two nodes can be in
+				// the other one. Look everywhere.
+				int ssize = shortlist.size();
+				for( int sh = 0; sh < ssize; sh++ )
+					if( shortlist[sh] != node && findsphere(shortlist[sh], _sidx, _to) )
+						break;
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// renamesphere() for one node. False if _sidx isn't there.
+		bool findsphere( Spocket *_node, int _sidx, int _to ) {
+			if( !_node ) return false;
+			PArenaArray <int> &indices = _node->sindices;
+			int numsidx = indices.size();
+			for( int s = 0; s < numsidx; s++ ) {
+				if( indices[s] != _sidx ) continue;
+				if( _to >= 0 ) {
+					indices[s] = _to;
+					std::sort( indices.begin(), indices.end() );
+				}
+				else {
+					for( int m = s + 1; m < numsidx; m++ )
+						indices[m - 1] = indices[m];
+					indices.resize( numsidx - 1 );
+				}
+				_node->numsindices = indices.size();
+				return true;
+			}
+			return false;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Puts _count spheres in the tree at once. Same buckets as
+		// _addsphere()-ing each, and every bucket ends up in index order
+		// either way. Sorted by Morton key first, so each node gets its
+		// spheres as one run and each sphere is only tested against the
+		// child its key points at.
+		void placespheres( const int *_sidx, int _count ) {
+			if( !root || _count <= 0 ) return;
+			// Lanes to spread over. Each gets a few chunks, so a slow one
+			// doesn't hold the rest up much.
+			int numlanes = ( jobs && _count >= PARALLELMIN ) ? jobs->threads() : 1;
+			while( (int)lanes.size() < numlanes )
+				lanes.emplace_back();
+			int numchunks = ( numlanes > 1 ) ? numlanes * 4 : 1;
+			int chunksize = ( _count + numchunks - 1 ) / numchunks;
+
+			// Scale from the root's bounds to key cells.
+			vec3 len = root->poslm - root->neglm;
+			vec3 scale( KEYCELLS / len.x, KEYCELLS / len.y, KEYCELLS / len.z );
+			SpocKey *keys = arena.alloc<SpocKey>( _count );
+			SpocKey *tmp = arena.alloc<SpocKey>( _count );
+			// Spheres outside the root need the tree to grow, they go in
+			// one at a time afterwards.
+			int *outside = arena.alloc<int>( _count );
+			// Keys and outside spheres found by each chunk.
+			int *chunkkeys = arena.alloc<int>( numchunks );
+			int *chunkoutside = arena.alloc<int>( numchunks );
+
+			forchunks( numchunks, [&]( int _chunk, int ) {
+				int first = _chunk * chunksize;
+				int last = ( first + chunksize < _count ) ? first + chunksize : _count;
+				int numkeys = 0;
+				int numoutside = 0;
+				vec3 spheer;
+				vec3 bx[2];
+				for( int s = first; s < last; s++ ) {
+					buildspherebox( root, _sidx[s], &spheer, bx );
+					if( !sphereboxinbox(spheer, bx) ) {
+						outside[ first + numoutside++ ] = _sidx[s];
+						continue;
+					}
+					vec3 cell = spheer - root->neglm;
+					SpocKey &k = keys[ first + numkeys++ ];
+					k.key = ( spreadbits( keycell(cell.x * scale.x) ) << 2 ) |
+							( spreadbits( keycell(cell.y * scale.y) ) << 1 ) |
+							  spreadbits( keycell(cell.z * scale.z) );
+					k.sidx = _sidx[s];
+				}
+				chunkkeys[_chunk] = numkeys;
+				chunkoutside[_chunk] = numoutside;
+			} );
+
+			// Close the gaps between chunks.
+			int numkeys = chunkkeys[0];
+			int numoutside = chunkoutside[0];
+			for( int c = 1; c < numchunks; c++ ) {
+				int first = c * chunksize;
+				for( int k = 0; k < chunkkeys[c]; k++ )
+					keys[ numkeys++ ] = keys[ first + k ];
+				for( int o = 0; o < chunkoutside[c]; o++ )
+					outside[ numoutside++ ] = outside[ first + o ];
+			}
+
+			// Sort, then copy the spheres out in key order, so handing runs
+			// down the tree never jumps around slist.
+			keys = sortkeys( keys, tmp, numkeys, numchunks );
+			vec3 *spheres = arena.alloc<vec3>( numkeys );
+			chunksize = ( numkeys + numchunks - 1 ) / numchunks;
+			forchunks( numchunks, [&]( int _chunk, int ) {
+				int first = _chunk * chunksize;
+				int last = ( first + chunksize < numkeys ) ? first + chunksize : numkeys;
+				for( int k = first; k < last; k++ ) {
+					spheres[k] = slist[ keys[k].sidx ].pos;
+					spheres[k].w = slist[ keys[k].sidx ].rad;
+				}
+			} );
+
+			if( numlanes == 1 ) {
+				_placerun( root, keys, spheres, numkeys, 0 );
+			}
+			else {
+				// Hand runs down on this thread a level at a time until
+				// there are a few per lane. Then every run's subtree is a
+				// job of its own.
+				PArenaArray <SpocRun> runs( &arena );
+				PArenaArray <SpocRun> deeper( &arena );
+				SpocRun top = { root, keys, spheres, numkeys, 0 };
+				runs.push_back( top );
+				for( int l = 0; l < KEYBITS && !runs.empty() && runs.size() < numlanes * 4; l++ ) {
+					deeper.clear();
+					for( int r = 0; r < runs.size(); r++ )
+						_placerun( runs[r].node, runs[r].keys, runs[r].spheres, runs[r].count,
+								   runs[r].level, 0, &deeper );
+					runs.swap( deeper );
+				}
+				jobs->parallelfor( runs.size(), [&]( int _run, int _lane ) {
+					_placerun( runs[_run].node, runs[_run].keys, runs[_run].spheres, runs[_run].count,
+							   runs[_run].level, _lane + 1 );
+				} );
+				// The lanes' shortlists and counts go back in the tree's.
+				for( int l = 0; l < numlanes; l++ ) {
+					shortlist.append( lanes[l].listed.begin(), lanes[l].listed.size() );
+					lanes[l].listed.clear();
+					PSTATS_ADD( nodesvisited, lanes[l].nodesvisited );
+					lanes[l].nodesvisited = 0;
+				}
+			}
+
+			for( int o = 0; o < numoutside; o++ )
+				placesphere( outside[o] );
+
+			// Lanes only saw their own subtrees, the nodes above them get
+			// their layers now.
+			if( layered )
+				spreadlayers();
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Sets sphere _sidx's layer bits. Takes effect when it's next placed.
+		void setlayers( int _sidx, unsigned int _layers ) {
+			slist[_sidx].layers = _layers;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Layers of every sphere in and under _node. All of them when the
+		// tree isn't layered, anything could be there.
+		unsigned int nodelayers( const Spocket *_node ) const {
+			return layered ? _node->layers : 0xFFFFFFFF;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Adds every shortlisted node's layers to the nodes above it.
+		void spreadlayers( void ) {
+			int ssize = shortlist.size();
+			for( int sh = 0; sh < ssize; sh++ ) {
+				unsigned int layers = shortlist[sh]->layers;
+				for( Spocket *up = shortlist[sh]->parent; up && (up->layers & layers) != layers; up = up->parent )
+					up->layers |= layers;
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Runs _fn( chunk, lane ) for every chunk, on jobs if there's more
+		// than one.
+		template <class F>
+		void forchunks( int _numchunks, const F &_fn ) {
+			if( _numchunks > 1 )
+				jobs->parallelfor( _numchunks, _fn );
+			else
+				_fn( 0, 0 );
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Key cells along each axis, 10 bits' worth. Keys sort 10 levels
+		// deep, below that placespheres() goes one sphere at a time.
+		static const int KEYBITS = 10;
+		static const int KEYCELLS = 1 << KEYBITS;
+
+		///////////////////////////////////////////////////////////////////////
+		// Cell along one axis, clamped to the root. NaN ends up in 0.
+		static unsigned int keycell( float _f ) {
+			if( !( _f > 0.0f ) ) return 0;
+			if( _f >= KEYCELLS - 1 ) return KEYCELLS - 1;
+			return (unsigned int)_f;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Spreads 10 bits out to every third bit, ready to interleave.
+		static unsigned int spreadbits( unsigned int _v ) {
+			_v = ( _v | (_v << 16) ) & 0x030000FF;
+			_v = ( _v | (_v << 8) ) & 0x0300F00F;
+			_v = ( _v | (_v << 4) ) & 0x030C30C3;
+			_v = ( _v | (_v << 2) ) & 0x09249249;
+			return _v;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Radix sorts _keys by key, 10 bits a pass. _tmp is scratch the same
+		// size. Returns whichever of the two ended up sorted.
+		// Every pass counts digits per chunk, works out where each chunk's
+		// digits start, then scatters. Chunks run on their own lanes, and
+		// it's stable, same as one chunk.
+		SpocKey *sortkeys( SpocKey *_keys, SpocKey *_tmp, int _count, int _numchunks ) {
+			int chunksize = ( _count + _numchunks - 1 ) / _numchunks;
+			int *counts = arena.alloc<int>( _numchunks * KEYCELLS );
+			for( int shift = 0; shift < 3 * KEYBITS; shift += KEYBITS ) {
+				forchunks( _numchunks, [&]( int _chunk, int ) {
+					int *cnt = counts + _chunk * KEYCELLS;
+					for( int d = 0; d < KEYCELLS; d++ )
+						cnt[d] = 0;
+					int first = _chunk * chunksize;
+					int last = ( first + chunksize < _count ) ? first + chunksize : _count;
+					for( int k = first; k < last; k++ )
+						cnt[ (_keys[k].key >> shift) & (KEYCELLS - 1) ]++;
+				} );
+				// Counts become where each chunk's run of each digit starts.
+				int start = 0;
+				for( int d = 0; d < KEYCELLS; d++ ) {
+					for( int c = 0; c < _numchunks; c++ ) {
+						int num = counts[ c * KEYCELLS + d ];
+						counts[ c * KEYCELLS + d ] = start;
+						start += num;
+					}
+				}
+				forchunks( _numchunks, [&]( int _chunk, int ) {
+					int *at = counts + _chunk * KEYCELLS;
+					int first = _chunk * chunksize;
+					int last = ( first + chunksize < _count ) ? first + chunksize : _count;
+					for( int k = first; k < last; k++ )
+						_tmp[ at[ (_keys[k].key >> shift) & (KEYCELLS - 1) ]++ ] = _keys[k];
+				} );
+				std::swap( _keys, _tmp );
 			}
+			return _keys;
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Places a run of sorted keys, and their spheres, that all fit in
+		// _node. _level is how many levels below the root _node's children
+		// are, which picks the key bits for them. _lane is the thread doing
+		// it. With _defer, runs for the children go in there instead of
+		// being placed.
+		void _placerun( Spocket *_node, SpocKey *_run, vec3 *_spheres, int _count, int _level,
+						int _lane = 0, PArenaArray <SpocRun> *_defer = 0 ) {
+			PSTATS_ADD( lanevisits(_lane), 1 );
+			if( sparse ) {
+				_node->numinside += _count;
+				// Crowded sparse leaves get children before anything goes in.
+				if( !_node->childs[0] && _node->depth < maxdepth &&
+					_node->sindices.size() + _count > splitcount )
+					split( _node, _lane );
+			}
+			int numbefore = _node->sindices.size();
+
+			if( !_node->childs[0] ) {
+				// Leaf, everything stays.
+				for( int r = 0; r < _count; r++ )
+					keep( _node, _run[r].sidx, _lane );
+			}
+			else if( _level >= KEYBITS ) {
+				// Deeper than the keys go.
+				for( int r = 0; r < _count; r++ ) {
+					bool placed = false;
+					for( int c = 0; c < 8 && !placed; c++ )
+						placed = _addsphere( _node->childs[c], _run[r].sidx, _lane );
+					if( !placed )
+						keep( _node, _run[r].sidx, _lane );
+				}
+			}
+			else {
+				// Keys for one child sit together. Spheres that straddle
+				// their child stay here, the rest go down as one run.
+				const int shift = 3 * ( KEYBITS - 1 - _level );
+				int r = 0;
+				while( r < _count ) {
+					unsigned int oct = ( _run[r].key >> shift ) & 7;
+					Spocket *child = _node->childs[ octchild(oct) ];
+					int fit = r;
+					int end = r;
+					vec3 bx[2] = { child->poslm, child->neglm };
+					for( ; end < _count && ( (_run[end].key >> shift) & 7 ) == oct; end++ ) {
+						if( sphereboxinbox(_spheres[end], bx) ) {
+							_spheres[fit] = _spheres[end];
+							_run[ fit++ ] = _run[end];
+						}
+						else
+							keep( _node, _run[end].sidx, _lane );
+					}
+					if( fit > r ) {
+						if( _defer ) {
+							SpocRun run = { child, _run + r, _spheres + r, fit - r, _level + 1 };
+							_defer->push_back( run );
+						}
+						else
+							_placerun( child, _run + r, _spheres + r, fit - r, _level + 1, _lane );
+					}
+					r = end;
+				}
+			}
+
+			// Anything new here goes in index order, like _addsphere() leaves it.
+			_node->numsindices = _node->sindices.size();
+			if( _node->numsindices > numbefore ) {
+				std::sort( _node->sindices.begin() + numbefore, _node->sindices.end() );
+				addtoshortlist( _node, _lane );
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Child index(see makechildren()) for a key octant, x/y/z bits high
+		// to low. Bit set is the positive half.
+		static int octchild( unsigned int _oct ) {
+			static const int childs[8] = { 7, 4, 3, 0, 6, 5, 2, 1 };
+			return childs[_oct];
 		}
 
 		///////////////////////////////////////////////////////////////////////
@@ -404,8 +1076,10 @@ class SpocTree {
 
             // If this is the first call, start with root.
             if( _node == 0 ) {
-                _node = &*bucketlist.begin();
+                if( !root ) return 0;
+                _node = root;
             }
+            PSTATS_ADD( nodesvisited, 1 );
 
 		    // Get the sphere and Spocket bounds.
 			vec3 spheer;
@@ -435,23 +1109,83 @@ class SpocTree {
         // removes indices from the buckets it was pointing too.
         // Handy when you need to remove indices only from the buckets
         // that were used.
+        // Only shortlisted buckets have indices, so once they're emptied
+        // the arena can start over.
         void clearshortlist(  ) {
             // Clear the short list.
             int ssize = shortlist.size();
-            for( int sh = 0; sh < ssize; sh++ )
-                shortlist[sh]->sindices.clear();
-            shortlist.clear();
+            for( int sh = 0; sh < ssize; sh++ ) {
+                shortlist[sh]->sindices.setarena( &arena );
+                shortlist[sh]->numsindices = 0;
+                shortlist[sh]->listed = false;
+                // Layers went up to the root from here. Stops at the first
+                // node another walk already cleared.
+                if( shortlist[sh]->layers ) {
+                    for( Spocket *up = shortlist[sh]; up && up->layers; up = up->parent )
+                        up->layers = 0;
+                }
+            }
+            // Sparse trees drop the nodes that went quiet.
+            if( sparse && root )
+                prune( root );
+            resetarenas();
         }
 
+		///////////////////////////////////////////////////////////////////////
+		// Throws away every bucket index, the shortlist and lane scratch.
+		void resetarenas( void ) {
+			arena.reset();
+			shortlist.setarena( &arena );
+			for( unsigned int l = 0; l < lanes.size(); l++ ) {
+				lanes[l].arena.reset();
+				lanes[l].listed.setarena( &lanes[l].arena );
+			}
+		}
+
         //
         void refreshsphere( int sidx, vec3 &pos ) {
             slist[sidx].pos = pos;
-            _addsphere( &*bucketlist.begin(), sidx );
+            placesphere( sidx );
         }
 
         void reset( void ) {
             clearshortlist();
         }
+
+		///////////////////////////////////////////////////////////////////////
+		// Finds every sphere in a bucket that overlaps the box around the
+		// given sphere. The sphere doesn't have to be in the tree.
+		// Indices are added to _found(std::vector or PArenaArray), nothing in
+		// the tree changes. In a layered tree, subtrees without any of
+		// _layers are skipped.
+		template <class List>
+		void query( const vec3 &_pos, float _radius, List &_found, unsigned int _layers = 0xFFFFFFFF,
+					Spocket *_node = 0 ) {
+			// Start at the root. Nothing to find in an empty tree.
+			if( _node == 0 ) {
+				if( !root ) return;
+				_node = root;
+			}
+			PSTATS_ADD( nodesvisited, 1 );
+
+			// Sphere's box misses this node, and so all of its children.
+			if( _pos.x - _radius > _node->poslm.x || _pos.x + _radius < _node->neglm.x ||
+				_pos.y - _radius > _node->poslm.y || _pos.y + _radius < _node->neglm.y ||
+				_pos.z - _radius > _node->poslm.z || _pos.z + _radius < _node->neglm.z )
+				return;
+			// Nothing in the right layers down here.
+			if( !( nodelayers(_node) & _layers ) )
+				return;
+
+			int numsidx = _node->sindices.size();
+			for( int s = 0; s < numsidx; s++ )
+				_found.push_back( _node->sindices[s] );
+
+			if( _node->childs[0] ) {
+				for( int c = 0; c < 8; c++ )
+					query( _pos, _radius, _found, _layers, _node->childs[c] );
+			}
+		}
 
 		///////////////////////////////////////////////////////////////////////
 		// Cleans up lists/memory.
@@ -460,6 +1194,11 @@ class SpocTree {
 			shortlist.clear();
 			slist.clear();
 			bucketlist.clear();
+			freenodes.clear();
+			root = 0;
+			resetarenas();
 			numnodes = 0;
 		}
 };
+
+#endif // SPOCTREE_H
@@ -8,6 +8,8 @@
 #include <windows.h>
 #include <stdio.h>
 
+// Fill pworld.stats every step. Drives the timing overlay below.
+#define PBOX_STATS
 // Physics Box.
 #include "PBox.h"
 // Soft3DRenderer
@@ -102,8 +104,22 @@ int WINAPI WinMain (HINSTANCE hThisInstance,
 		for( int bx = 0; bx < numboxes - 1; bx++ ) {
 			pboxes[bx] = PBox( vpos + vec3((bx % 2) * 0.5f,  1 + bx * 1.25f, 0), vsize, vscal, vrota, vang, true );
 			//pboxes[bx].setvel( vec3(0, -0.01f, 0) );
+			pboxes[bx].setaccel( vec3(0, -0.001f, 0) );
 		}
 		pboxes[numboxes - 1] = PBox( vec3(0, 0, 0), vec3(1, 1, 1), vec3(4, 1, 4), vrota, vang, false );
+		// The ground box above is only drawn. This plane, level with its top
+		// face, is what the other boxes land on.
+		pworld.addplane( PPlane(vec3(0, 1, 0), 0.5f) );
+		// Impulse solver. Settles in far fewer steps than nudging, so two
+		// update()s a frame instead of five.
+		pworld.solver = PSOLVER_IMPULSE;
+		pworld.iterations = 10;
+		// Octree nodes only where the boxes are.
+		sptree.sparse = true;
+		// Every core, contacts solved in color batches so the solver uses
+		// them too.
+		pworld.jobs.setthreads( std::thread::hardware_concurrency() );
+		pworld.colorbatches = true;
 
 	// Physics Box.
 	///////////////
@@ -137,6 +153,7 @@ int WINAPI WinMain (HINSTANCE hThisInstance,
 				pboxes[bx].rangle = vang;
 				// PBox( vpos + vec3((bx % 2) * 0.5f,  1 + bx * 1.25f, 0), vsize, vscal, vrota, vang, true );
 				pboxes[bx].setvel( vec3(0, -0.01f, 0) );
+				pboxes[bx].setangvel( vec3(0, 0, 0) );
 			}
 		}
 		///////
@@ -160,26 +177,35 @@ int WINAPI WinMain (HINSTANCE hThisInstance,
 
 		if(true)
 		{
-			static int stimer = 0;
-			static int numcnts = 1;
-			static int avgtime = 0;
-			if( stimer == 0 )
-				stimer = GetTickCount();
-
 			// Update box velocities, position, etc.
-			for(int u = 0; u < 5; u++)
-				PBox::update( pboxes, numboxes );
+			// Stats are per update(), so total them for the frame.
+			PStepStats framestats;
+			for(int u = 0; u < 2; u++) {
+				PBox::update( pboxes, numboxes - 1 );
+				framestats += pworld.stats;
+			}
+
+			// Running average of the whole frame's update() time.
+			static double avgtime = 0.0;
+			static int numcnts = 0;
+			avgtime += framestats.total;
+			numcnts++;
 
 			char strbfr[100] = {0};
-			avgtime += (GetTickCount() - stimer);
-			sprintf( strbfr, "UpdateBoxes() Time - %d", GetTickCount() - stimer );
+			sprintf( strbfr, "UpdateBoxes() Time - %.3fms", framestats.total );
 			TextOut( boop.GetBackbuffer(), 10, 80, strbfr, strlen(strbfr) );
-			for( int c = 0; c < 100; c++ ) strbfr[c] = 0;
-
-			sprintf( strbfr, "UpdateBoxes() Avg Time - %d", avgtime / numcnts );
+			sprintf( strbfr, "UpdateBoxes() Avg Time - %.3fms", avgtime / numcnts );
 			TextOut( boop.GetBackbuffer(), 10, 100, strbfr, strlen(strbfr) );
-			stimer = 0;
-			numcnts++;
+			sprintf( strbfr, "Integrate %.3f  Tree %.3f  GetBucket %.3f",
+					 framestats.integrate, framestats.treerefresh, framestats.getbucket );
+			TextOut( boop.GetBackbuffer(), 10, 120, strbfr, strlen(strbfr) );
+			sprintf( strbfr, "Narrowphase %.3f  Penetration %.3f  Reaction %.3f",
+					 framestats.narrowphase, framestats.penetration, framestats.reaction );
+			TextOut( boop.GetBackbuffer(), 10, 140, strbfr, strlen(strbfr) );
+			sprintf( strbfr, "Early Outs %u  Edge/Face Tests %u  Contacts %u  Nodes %u",
+					 framestats.sphereearlyouts, framestats.edgefacetests,
+					 framestats.contactpoints, framestats.nodesvisited );
+			TextOut( boop.GetBackbuffer(), 10, 160, strbfr, strlen(strbfr) );
 		}
 
 		for( int cb = 0; cb < numboxes; cb++ ) {
@@ -315,21 +341,18 @@ void drawspoc( void ) {
 	TextOut( boop.GetBackbuffer(), 10, 300, strbfr, strlen(strbfr) );
 
 	for( int chr = 0; chr < 100; chr++ ) strbfr[chr] = 0;
-	sprintf( strbfr, "sptree.bucketlist.size() - %d", sptree.bucketlist.size() );
+	sprintf( strbfr, "sptree.numnodes - %d", sptree.numnodes );
 	TextOut( boop.GetBackbuffer(), 10, 325, strbfr, strlen(strbfr) );
 
-	std::list<Spocket>::iterator begit = sptree.bucketlist.begin();
-	std::list<Spocket>::iterator endit = sptree.bucketlist.end();
-	std::list<Spocket>::iterator buckit = begit;
-
-
 	const int ZEROX = 400;
 	const int ZEROY = 400;
 
 	SelectObject( boop.GetBackbuffer(), hredpen );
 
-	for( buckit = begit; buckit != endit; buckit++ ) {
-		Spocket &sp = *buckit;
+	for( unsigned int buckit = 0; buckit < sptree.bucketlist.size(); buckit++ ) {
+		Spocket &sp = sptree.bucketlist[buckit];
+		// Merged away.
+		if( sp.id < 0 ) continue;
 		MoveToEx( boop.GetBackbuffer(), ZEROX + sp.neglm.x, ZEROY - sp.neglm.y, 0 );
 		LineTo(  boop.GetBackbuffer(),  ZEROX + sp.neglm.x, ZEROY - sp.poslm.y );
 		LineTo(  boop.GetBackbuffer(),  ZEROX + sp.poslm.x, ZEROY - sp.poslm.y );